@@ -0,0 +1,67 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "duckforeach.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#ifndef NUM_CALL_SITES
+#define NUM_CALL_SITES 1
+#endif
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+// Each call site picks one of 64 signatures from the bits of its index, like a program
+// that iterates different queries, so that every call site is a distinct instantiation.
+template <std::size_t I> void call_site(ddb::Connection& con, std::size_t& numRows)
+{
+    using A = std::conditional_t<(I & 1) != 0, int64_t, double>;
+    using B = std::conditional_t<(I & 2) != 0, std::string, std::optional<int32_t>>;
+    using C = std::conditional_t<(I & 4) != 0, dfe::Timestamp, ddb::timestamp_t>;
+    using D = std::conditional_t<(I & 8) != 0, const std::string&, std::string_view>;
+    using E = std::conditional_t<(I & 16) != 0, std::optional<double>, float>;
+    using F = std::conditional_t<(I & 32) != 0, bool, std::optional<bool>>;
+
+    dfe::for_each(con.Query("select ival, ival::INTEGER, ts, sval, rval, bval from t"),
+                  [&](A, B, C, D, E, F) { ++numRows; });
+}
+
+template <std::size_t... Is>
+void call_sites(ddb::Connection& con, std::size_t& numRows, std::index_sequence<Is...>)
+{
+    (call_site<Is>(con, numRows), ...);
+}
+
+int main()
+{
+    try
+    {
+        ddb::DuckDB db;
+        ddb::Connection con{db};
+
+        auto res{con.Query("CREATE TABLE t AS SELECT i AS ival, "
+                           "TIMESTAMP '2024-06-01' + INTERVAL (i) MINUTE AS ts, "
+                           "'label' || i AS sval, i / 2 AS rval, i % 2 = 0 AS bval "
+                           "FROM range(10) t(i)")};
+        if (res->HasError())
+            throw std::runtime_error(res->GetError());
+
+        std::size_t numRows{0};
+        call_sites(con, numRows, std::make_index_sequence<NUM_CALL_SITES>{});
+        std::cout << std::format("Processed {} rows in {} call sites", numRows, NUM_CALL_SITES)
+                  << std::endl;
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+# Measures the compile time of the compile_bench translation units, run with:
+#   cmake -DBUILD_DIR=<build dir> -P examples/compile_bench/measure.cmake
+if(NOT BUILD_DIR)
+    message(FATAL_ERROR "Set BUILD_DIR to a configured build directory.")
+endif()
+
+# The copy of main.cpp compiled by the targets.
+set(source ${BUILD_DIR}/examples/compile_bench/main.cpp)
+if(NOT EXISTS ${source})
+    message(FATAL_ERROR "Cannot find ${source}, configure BUILD_DIR first.")
+endif()
+
+function(build target)
+    execute_process(COMMAND ${CMAKE_COMMAND} --build ${BUILD_DIR} --target ${target}
+                    RESULT_VARIABLE result OUTPUT_QUIET)
+    if(result)
+        message(FATAL_ERROR "Cannot build ${target}")
+    endif()
+endfunction()
+
+# Builds duckdb and the precompiled header so that only main.cpp is compiled below.
+build(duckforeach_pch)
+
+foreach(variant compile_bench compile_bench_pch)
+    foreach(sites 1 10 50)
+        file(TOUCH ${source})
+
+        string(TIMESTAMP start "%s%f")
+        build(${variant}_${sites})
+        string(TIMESTAMP stop "%s%f")
+
+        math(EXPR millis "(${stop} - ${start}) / 1000")
+        message("${variant}_${sites}: ${millis} ms")
+    endforeach()
+endforeach()
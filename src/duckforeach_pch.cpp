@@ -0,0 +1,4 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+
+// Empty source used to build the duckforeach.hpp precompiled header.
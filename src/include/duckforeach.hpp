@@ -5,19 +5,64 @@
 #include "duckdb.hpp"
 
 #ifndef DUCKDB_AMALGAMATION
+#include "duckdb/common/arrow/arrow_converter.hpp"
+#include "duckdb/common/types/blob.hpp"
 #include "duckdb/common/types/date.hpp"
 #include "duckdb/common/types/time.hpp"
 #include "duckdb/common/types/timestamp.hpp"
 #endif
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <compare>
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
 #include <format>
 #include <functional>
+#include <istream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <ostream>
+#include <random>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#define DUCKFOREACH_HAS_UNISTD
+#endif
+
+#if defined(DUCKFOREACH_HAS_UNISTD) && __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define DUCKFOREACH_HAS_MMAP
+#endif
 
 namespace duckforeach {
 
@@ -72,30 +117,194 @@ std::basic_ostream<C, T>& operator<<(std::basic_ostream<C, T>& os, const Timesta
     return os;
 }
 
+// A read-only view of a DuckDB BIT value, it references the query result data so it is
+// valid only for the duration of the function call.
+class BitView
+{
+public:
+    BitView() = default;
+
+    // The data uses the DuckDB encoding: a byte with the number of padding bits followed
+    // by the bits with the most significant bit first.
+    explicit BitView(std::span<const std::byte> data)
+        : mData{data}
+    {
+    }
+
+    std::size_t size() const
+    {
+        return mData.empty() ? 0 : (mData.size() - 1) * 8 - padding();
+    }
+
+    bool operator[](std::size_t pos) const
+    {
+        auto bit{pos + padding()};
+        return (std::to_integer<uint8_t>(mData[bit / 8 + 1]) >> (7 - bit % 8)) & 1;
+    }
+
+    bool test(std::size_t pos) const
+    {
+        if (pos >= size())
+            throw std::out_of_range{
+                std::format("Bit position {} out of range for a {} bits value", pos, size())};
+        return (*this)[pos];
+    }
+
+    // Number of bits set to one.
+    std::size_t count() const
+    {
+        if (mData.size() < 2)
+            return 0;
+
+        // Padding bits are stored as ones so mask them out.
+        auto first{std::to_integer<uint8_t>(mData[1]) & (0xFFu >> padding())};
+        std::size_t bits = std::popcount(first);
+        for (auto b : mData.subspan(2))
+            bits += std::popcount(std::to_integer<uint8_t>(b));
+        return bits;
+    }
+
+    std::string to_string() const
+    {
+        std::string s(size(), '0');
+        for (std::size_t i{0}; i < s.size(); ++i)
+            if ((*this)[i])
+                s[i] = '1';
+        return s;
+    }
+
+    // The raw DuckDB encoded data.
+    std::span<const std::byte> data() const
+    {
+        return mData;
+    }
+
+private:
+    std::size_t padding() const
+    {
+        return std::to_integer<std::size_t>(mData[0]);
+    }
+
+    std::span<const std::byte> mData;
+};
+
+template <class C, class T>
+std::basic_ostream<C, T>& operator<<(std::basic_ostream<C, T>& os, const BitView& bits)
+{
+    os << bits.to_string();
+    return os;
+}
+
+// Statistics collected by a streaming for_each.
+struct StreamStats
+{
+    std::size_t chunks{0};
+    std::size_t rows{0};
+    std::size_t peak_buffered_chunks{0};
+    std::size_t peak_buffered_bytes{0};
+};
+
+// Progress of a streaming for_each, reported after each chunk.
+struct Progress
+{
+    std::size_t rows{0};
+    std::size_t chunks{0};
+    // Estimated percentage of the query completed or -1 if unknown, for stream results
+    // DuckDB estimates it only with the enable_progress_bar setting.
+    double percent{-1};
+};
+
+// Cancels a streaming for_each from any thread, the iteration stops before the next chunk
+// and the running query of a stream result is interrupted.
+class CancellationToken
+{
+public:
+    void cancel()
+    {
+        mCancelled = true;
+
+        std::lock_guard lock{mMutex};
+        if (mContext)
+            mContext->Interrupt();
+    }
+
+    bool cancelled() const
+    {
+        return mCancelled;
+    }
+
+    // The query context interrupted by cancel, reset by passing nullptr.
+    void attach(duckdb::ClientContext* context)
+    {
+        std::lock_guard lock{mMutex};
+        mContext = context;
+        if (mContext && mCancelled)
+            mContext->Interrupt();
+    }
+
+private:
+    std::atomic<bool> mCancelled{false};
+    std::mutex mMutex;
+    duckdb::ClientContext* mContext{nullptr};
+};
+
+// Options for a streaming for_each.
+struct StreamOptions
+{
+    // Maximum number of chunks in memory, including the one being processed.
+    std::size_t max_chunks{2};
+    // If not null receives the iteration statistics.
+    StreamStats* stats{nullptr};
+    // If not null stops the iteration when cancelled, for_each then returns the function
+    // object with the rows processed so far.
+    CancellationToken* cancellation{nullptr};
+    // If set is called after each chunk has been processed.
+    std::function<void(const Progress&)> progress{};
+};
+
 namespace details {
 
+inline std::invalid_argument null_value_error(std::size_t column, const char* typestr)
+{
+    return std::invalid_argument{std::format("Cannot convert null value at column {} to "
+                                             "{} use std::optional for this column",
+                                             column, typestr)};
+}
+
+// The error message for a value that cannot be converted, column and row are 1-based.
+inline std::string conversion_error(std::string_view value,
+                                    std::size_t column,
+                                    std::size_t row,
+                                    std::string_view type,
+                                    std::string_view typestr)
+{
+    return std::format("Cannot convert value {} at column {} row {} of type {} to {}", value,
+                       column, row, type, typestr);
+}
+
 template <typename T>
-inline void cast_value(std::size_t column, const char* typestr, duckdb::Value& dbval, T& outval)
+inline void cast_value(
+    std::size_t column, std::size_t row, const char* typestr, duckdb::Value& dbval, T& outval)
 {
     if (dbval.IsNull())
-        throw std::invalid_argument{std::format("Cannot convert null value at column {} to "
-                                                "{} use std::optional for this column",
-                                                column, typestr)};
+        throw null_value_error(column, typestr);
     try
     {
         outval = dbval.GetValue<T>();
     }
     catch (const std::exception& e)
     {
-        throw std::invalid_argument{std::format("Cannot convert value at column {} of type {}"
-                                                " to {}",
-                                                column, dbval.type().ToString(), typestr)};
+        throw std::invalid_argument{
+            conversion_error(dbval.ToString(), column, row, dbval.type().ToString(), typestr)};
     }
 }
 
 template <typename T>
-inline void
-cast_value(std::size_t column, const char* typestr, duckdb::Value& dbval, std::optional<T>& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       const char* typestr,
+                       duckdb::Value& dbval,
+                       std::optional<T>& outval)
 {
     if (dbval.IsNull())
         outval = std::nullopt;
@@ -107,175 +316,215 @@ cast_value(std::size_t column, const char* typestr, duckdb::Value& dbval, std::o
         }
         catch (const std::exception& e)
         {
-            throw std::invalid_argument{std::format("Cannot convert value at column {} of type {}"
-                                                    " to {}",
-                                                    column, dbval.type().ToString(), typestr)};
+            throw std::invalid_argument{conversion_error(dbval.ToString(), column, row,
+                                                         dbval.type().ToString(), typestr)};
         }
     }
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, bool& outval)
-{
-    cast_value(column, "bool", dbval, outval);
-}
-
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<bool>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, bool& outval)
 {
-    cast_value(column, "bool", dbval, outval);
+    cast_value(column, row, "bool", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, int8_t& outval)
+inline void
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, std::optional<bool>& outval)
 {
-    cast_value(column, "int8", dbval, outval);
+    cast_value(column, row, "bool", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<int8_t>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, int8_t& outval)
 {
-    cast_value(column, "int8", dbval, outval);
+    cast_value(column, row, "int8", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, int16_t& outval)
+inline void
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, std::optional<int8_t>& outval)
 {
-    cast_value(column, "int16", dbval, outval);
+    cast_value(column, row, "int8", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<int16_t>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, int16_t& outval)
 {
-    cast_value(column, "int16", dbval, outval);
+    cast_value(column, row, "int16", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, int32_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<int16_t>& outval)
 {
-    cast_value(column, "int32", dbval, outval);
+    cast_value(column, row, "int16", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<int32_t>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, int32_t& outval)
 {
-    cast_value(column, "int32", dbval, outval);
+    cast_value(column, row, "int32", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, int64_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<int32_t>& outval)
 {
-    cast_value(column, "int64", dbval, outval);
+    cast_value(column, row, "int32", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<int64_t>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, int64_t& outval)
 {
-    cast_value(column, "int64", dbval, outval);
+    cast_value(column, row, "int64", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, uint8_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<int64_t>& outval)
 {
-    cast_value(column, "uint8", dbval, outval);
+    cast_value(column, row, "int64", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<uint8_t>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, uint8_t& outval)
 {
-    cast_value(column, "uint8", dbval, outval);
+    cast_value(column, row, "uint8", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, uint16_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<uint8_t>& outval)
 {
-    cast_value(column, "uint16", dbval, outval);
+    cast_value(column, row, "uint8", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<uint16_t>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, uint16_t& outval)
 {
-    cast_value(column, "uint16", dbval, outval);
+    cast_value(column, row, "uint16", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, uint32_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<uint16_t>& outval)
 {
-    cast_value(column, "uint32", dbval, outval);
+    cast_value(column, row, "uint16", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<uint32_t>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, uint32_t& outval)
 {
-    cast_value(column, "uint32", dbval, outval);
+    cast_value(column, row, "uint32", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, uint64_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<uint32_t>& outval)
 {
-    cast_value(column, "uint64", dbval, outval);
+    cast_value(column, row, "uint32", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<uint64_t>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, uint64_t& outval)
 {
-    cast_value(column, "uint64", dbval, outval);
+    cast_value(column, row, "uint64", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, double& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<uint64_t>& outval)
 {
-    cast_value(column, "double", dbval, outval);
+    cast_value(column, row, "uint64", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<double>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, double& outval)
 {
-    cast_value(column, "double", dbval, outval);
+    cast_value(column, row, "double", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, float& outval)
+inline void
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, std::optional<double>& outval)
 {
-    cast_value(column, "float", dbval, outval);
+    cast_value(column, row, "double", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<float>& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, float& outval)
 {
-    cast_value(column, "float", dbval, outval);
+    cast_value(column, row, "float", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::string& outval)
+inline void
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, std::optional<float>& outval)
 {
-    cast_value(column, "string", dbval, outval);
+    cast_value(column, row, "float", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<std::string>& outval)
+inline void
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, std::string& outval)
 {
-    cast_value(column, "string", dbval, outval);
+    cast_value(column, row, "string", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, duckdb::date_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<std::string>& outval)
 {
-    cast_value(column, "date", dbval, outval);
+    cast_value(column, row, "string", dbval, outval);
 }
 
 inline void
-cast_value(std::size_t column, duckdb::Value& dbval, std::optional<duckdb::date_t>& outval)
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, duckdb::date_t& outval)
 {
-    cast_value(column, "date", dbval, outval);
+    cast_value(column, row, "date", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, duckdb::dtime_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<duckdb::date_t>& outval)
 {
-    cast_value(column, "time", dbval, outval);
+    cast_value(column, row, "date", dbval, outval);
 }
 
 inline void
-cast_value(std::size_t column, duckdb::Value& dbval, std::optional<duckdb::dtime_t>& outval)
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, duckdb::dtime_t& outval)
 {
-    cast_value(column, "time", dbval, outval);
+    cast_value(column, row, "time", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, duckdb::timestamp_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<duckdb::dtime_t>& outval)
 {
-    cast_value(column, "timestamp", dbval, outval);
+    cast_value(column, row, "time", dbval, outval);
 }
 
 inline void
-cast_value(std::size_t column, duckdb::Value& dbval, std::optional<duckdb::timestamp_t>& outval)
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, duckdb::timestamp_t& outval)
 {
-    cast_value(column, "timestamp", dbval, outval);
+    cast_value(column, row, "timestamp", dbval, outval);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, duckdb::interval_t& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<duckdb::timestamp_t>& outval)
 {
-    cast_value(column, "interval", dbval, outval);
+    cast_value(column, row, "timestamp", dbval, outval);
 }
 
 inline void
-cast_value(std::size_t column, duckdb::Value& dbval, std::optional<duckdb::interval_t>& outval)
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, duckdb::interval_t& outval)
+{
+    cast_value(column, row, "interval", dbval, outval);
+}
+
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<duckdb::interval_t>& outval)
 {
-    cast_value(column, "interval", dbval, outval);
+    cast_value(column, row, "interval", dbval, outval);
 }
 
 inline year_month_day cast_to_ymd(duckdb::date_t date)
@@ -304,7 +553,18 @@ inline hh_mm_ss cast_to_hms(duckdb::dtime_t time)
     return hh_mm_ss{chr::duration_cast<chr::nanoseconds>(musecs)};
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, Timestamp& outval)
+inline Timestamp cast_to_timestamp(duckdb::timestamp_t ts)
+{
+    duckdb::date_t date;
+    duckdb::dtime_t time;
+    duckdb::Timestamp::Convert(ts, date, time);
+
+    year_month_day ymd{cast_to_ymd(date)};
+    hh_mm_ss hms{cast_to_hms(time)};
+    return Timestamp{std::chrono::sys_days{ymd} + hms.to_duration()};
+}
+
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, Timestamp& outval)
 {
     namespace chr = std::chrono;
     namespace ddb = duckdb;
@@ -312,7 +572,7 @@ inline void cast_value(std::size_t column, duckdb::Value& dbval, Timestamp& outv
     if (dbval.type().id() == duckdb::LogicalTypeId::TIMESTAMP_NS)
     {
         uint64_t epoch;
-        cast_value(column, "Timestamp", dbval, epoch);
+        cast_value(column, row, "Timestamp", dbval, epoch);
 
         ddb::timestamp_t ddbts{ddb::Timestamp::FromEpochNanoSeconds(epoch)};
 
@@ -328,24 +588,20 @@ inline void cast_value(std::size_t column, duckdb::Value& dbval, Timestamp& outv
     else
     {
         ddb::timestamp_t ddbts;
-        cast_value(column, "Timestamp", dbval, ddbts);
-
-        ddb::date_t date;
-        ddb::dtime_t time;
-        ddb::Timestamp::Convert(ddbts, date, time);
-
-        year_month_day ymd{cast_to_ymd(date)};
-        hh_mm_ss hms{cast_to_hms(time)};
-        outval = Timestamp{std::chrono::sys_days{ymd} + hms.to_duration()};
+        cast_value(column, row, "Timestamp", dbval, ddbts);
+        outval = cast_to_timestamp(ddbts);
     }
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<Timestamp>& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<Timestamp>& outval)
 {
     if (!dbval.IsNull())
     {
         Timestamp ts;
-        cast_value(column, dbval, ts);
+        cast_value(column, row, dbval, ts);
         outval = std::move(ts);
     }
     else
@@ -354,127 +610,5331 @@ inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<T
     }
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, year_month_day& outval)
+inline void
+cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, year_month_day& outval)
 {
     duckdb::date_t date;
-    cast_value(column, "year_month_day", dbval, date);
+    cast_value(column, row, "year_month_day", dbval, date);
     outval = cast_to_ymd(date);
 }
 
-inline void
-cast_value(std::size_t column, duckdb::Value& dbval, std::optional<year_month_day>& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<year_month_day>& outval)
 {
     std::optional<duckdb::date_t> date;
-    cast_value(column, "year_month_day", dbval, date);
+    cast_value(column, row, "year_month_day", dbval, date);
     if (date)
         outval = cast_to_ymd(*date);
     else
         outval = std::nullopt;
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, hh_mm_ss& outval)
+inline void cast_value(std::size_t column, std::size_t row, duckdb::Value& dbval, hh_mm_ss& outval)
 {
     duckdb::dtime_t time;
-    cast_value(column, "hh_mm_ss", dbval, time);
+    cast_value(column, row, "hh_mm_ss", dbval, time);
     outval = cast_to_hms(time);
 }
 
-inline void cast_value(std::size_t column, duckdb::Value& dbval, std::optional<hh_mm_ss>& outval)
+inline void cast_value(std::size_t column,
+                       std::size_t row,
+                       duckdb::Value& dbval,
+                       std::optional<hh_mm_ss>& outval)
 {
     std::optional<duckdb::dtime_t> time;
-    cast_value(column, "hh_mm_ss", dbval, time);
+    cast_value(column, row, "hh_mm_ss", dbval, time);
     if (time)
         outval = cast_to_hms(*time);
     else
         outval = std::nullopt;
 }
 
-template <std::size_t ColIdx, typename DbRow, typename... Cols>
-void cast_value(const DbRow& dbRow, std::tuple<Cols...>& outRow)
+// A row in a result chunk, the columns unified formats are computed once per chunk so
+// that zero-copy arguments can reference the vectors data.
+struct ChunkRow
+{
+    duckdb::DataChunk& chunk;
+    const duckdb::UnifiedVectorFormat* formats;
+    duckdb::idx_t row;
+    // The index in the result of the first chunk row, for error messages.
+    std::size_t firstRow{0};
+};
+
+// Returns the bytes of a string_t value at the given column or std::nullopt for nulls, the
+// returned span references the chunk data.
+inline std::optional<std::span<const std::byte>>
+read_bytes(std::size_t colIdx,
+           const char* typestr,
+           const ChunkRow& dbRow,
+           std::initializer_list<duckdb::LogicalTypeId> typeIds)
 {
-    auto dbval{dbRow.iterator.chunk->GetValue(ColIdx, dbRow.row)};
-    auto& outval{std::get<ColIdx>(outRow)};
+    auto& type{dbRow.chunk.data[colIdx].GetType()};
+    if (std::find(typeIds.begin(), typeIds.end(), type.id()) == typeIds.end())
+        throw std::invalid_argument{std::format("Cannot convert value at column {} of type {}"
+                                                " to {}",
+                                                colIdx + 1, type.ToString(), typestr)};
 
-    cast_value(ColIdx + 1, dbval, outval);
+    auto& format{dbRow.formats[colIdx]};
+    auto idx{format.sel->get_index(dbRow.row)};
+    if (!format.validity.RowIsValid(idx))
+        return std::nullopt;
 
-    if constexpr (ColIdx + 1 < sizeof...(Cols))
-        cast_value<ColIdx + 1>(dbRow, outRow);
+    auto& str{duckdb::UnifiedVectorFormat::GetData<duckdb::string_t>(format)[idx]};
+    return std::span{reinterpret_cast<const std::byte*>(str.GetData()), str.GetSize()};
 }
 
-template <typename... Cols, typename DbRow> auto cast_row(const DbRow& dbRow)
+inline void read_value(std::size_t colIdx,
+                       const ChunkRow& dbRow,
+                       std::optional<std::span<const std::byte>>& outval)
 {
-    std::tuple<std::decay_t<Cols>...> outRow;
-    cast_value<0>(dbRow, outRow);
-    return outRow;
+    using duckdb::LogicalTypeId;
+    outval = read_bytes(colIdx, "span<const byte>", dbRow,
+                        {LogicalTypeId::BLOB, LogicalTypeId::VARCHAR});
 }
 
-template <typename T>
-inline constexpr bool is_valid_argument_v =
-    std::is_same_v<T, bool> || std::is_same_v<T, std::optional<bool>> ||
-    std::is_same_v<T, int8_t> || std::is_same_v<T, std::optional<int8_t>> ||
-    std::is_same_v<T, int16_t> || std::is_same_v<T, std::optional<int16_t>> ||
-    std::is_same_v<T, int32_t> || std::is_same_v<T, std::optional<int32_t>> ||
-    std::is_same_v<T, int64_t> || std::is_same_v<T, std::optional<int64_t>> ||
-    std::is_same_v<T, uint8_t> || std::is_same_v<T, std::optional<uint8_t>> ||
-    std::is_same_v<T, uint16_t> || std::is_same_v<T, std::optional<uint16_t>> ||
-    std::is_same_v<T, uint32_t> || std::is_same_v<T, std::optional<uint32_t>> ||
-    std::is_same_v<T, uint64_t> || std::is_same_v<T, std::optional<uint64_t>> ||
-    std::is_same_v<T, double> || std::is_same_v<T, std::optional<double>> ||
-    std::is_same_v<T, float> || std::is_same_v<T, std::optional<float>> ||
-    std::is_same_v<T, std::string> || std::is_same_v<T, std::optional<std::string>> ||
-    std::is_same_v<T, duckdb::date_t> || std::is_same_v<T, std::optional<duckdb::date_t>> ||
-    std::is_same_v<T, duckdb::dtime_t> || std::is_same_v<T, std::optional<duckdb::dtime_t>> ||
-    std::is_same_v<T, duckdb::timestamp_t> ||
-    std::is_same_v<T, std::optional<duckdb::timestamp_t>> ||
-    std::is_same_v<T, duckdb::interval_t> || std::is_same_v<T, std::optional<duckdb::interval_t>> ||
-    std::is_same_v<T, Timestamp> || std::is_same_v<T, std::optional<Timestamp>> ||
-    std::is_same_v<T, year_month_day> || std::is_same_v<T, std::optional<year_month_day>> ||
-    std::is_same_v<T, hh_mm_ss> || std::is_same_v<T, std::optional<hh_mm_ss>>;
+inline void
+read_value(std::size_t colIdx, const ChunkRow& dbRow, std::span<const std::byte>& outval)
+{
+    std::optional<std::span<const std::byte>> bytes;
+    read_value(colIdx, dbRow, bytes);
+    if (!bytes)
+        throw null_value_error(colIdx + 1, "span<const byte>");
+    outval = *bytes;
+}
 
-template <typename T, typename... Args> constexpr bool is_valid_signature()
+inline void
+read_value(std::size_t colIdx, const ChunkRow& dbRow, std::optional<std::string_view>& outval)
 {
-    constexpr bool is_valid_arg{is_valid_argument_v<std::decay_t<T>>};
+    auto bytes{read_bytes(colIdx, "string_view", dbRow, {duckdb::LogicalTypeId::VARCHAR})};
+    if (bytes)
+        outval = std::string_view{reinterpret_cast<const char*>(bytes->data()), bytes->size()};
+    else
+        outval = std::nullopt;
+}
 
-    static_assert(is_valid_arg, "Invalid argument type T");
+inline void read_value(std::size_t colIdx, const ChunkRow& dbRow, std::string_view& outval)
+{
+    std::optional<std::string_view> str;
+    read_value(colIdx, dbRow, str);
+    if (!str)
+        throw null_value_error(colIdx + 1, "string_view");
+    outval = *str;
+}
 
-    if constexpr (is_valid_arg && sizeof...(Args) > 0)
-        return is_valid_signature<Args...>();
+// Reads a VARCHAR value into outval reusing its capacity, returns false for other column
+// types that are converted through a Value.
+template <typename T> bool read_string(std::size_t colIdx, const ChunkRow& dbRow, T& outval)
+{
+    if (dbRow.chunk.data[colIdx].GetType().id() != duckdb::LogicalTypeId::VARCHAR)
+        return false;
+
+    auto& format{dbRow.formats[colIdx]};
+    auto idx{format.sel->get_index(dbRow.row)};
+    if (!format.validity.RowIsValid(idx))
+    {
+        if constexpr (std::is_same_v<T, std::string>)
+            throw null_value_error(colIdx + 1, "string");
+        else
+            outval = std::nullopt;
+        return true;
+    }
+
+    auto& str{duckdb::UnifiedVectorFormat::GetData<duckdb::string_t>(format)[idx]};
+    if constexpr (std::is_same_v<T, std::string>)
+        outval.assign(str.GetData(), str.GetSize());
+    else if (outval)
+        outval->assign(str.GetData(), str.GetSize());
     else
-        return is_valid_arg;
+        outval.emplace(str.GetData(), str.GetSize());
+    return true;
 }
 
-template <typename F, typename R, typename... Args>
-auto for_each_impl(std::unique_ptr<duckdb::QueryResult> result, std::function<R(Args...)>&& f)
+inline void read_value(std::size_t colIdx, const ChunkRow& dbRow, std::optional<BitView>& outval)
 {
-    if constexpr (details::is_valid_signature<Args...>())
+    auto bytes{read_bytes(colIdx, "BitView", dbRow, {duckdb::LogicalTypeId::BIT})};
+    if (bytes)
+        outval = BitView{*bytes};
+    else
+        outval = std::nullopt;
+}
+
+inline void read_value(std::size_t colIdx, const ChunkRow& dbRow, BitView& outval)
+{
+    auto bytes{read_bytes(colIdx, "BitView", dbRow, {duckdb::LogicalTypeId::BIT})};
+    if (!bytes)
+        throw null_value_error(colIdx + 1, "BitView");
+    outval = BitView{*bytes};
+}
+
+// Types that are read directly from the chunk vectors without going through a Value.
+template <typename T> struct is_zero_copy : std::false_type
+{
+};
+
+template <> struct is_zero_copy<std::span<const std::byte>> : std::true_type
+{
+};
+
+template <> struct is_zero_copy<BitView> : std::true_type
+{
+};
+
+template <> struct is_zero_copy<std::string_view> : std::true_type
+{
+};
+
+template <typename T> struct is_zero_copy<std::optional<T>> : is_zero_copy<T>
+{
+};
+
+template <typename T> inline constexpr bool is_zero_copy_v = is_zero_copy<T>::value;
+
+// Numeric arguments are converted a vector at a time from flat integer and floating point
+// columns. Integers are range checked when Out is a narrower integer and rounded to the
+// nearest value when Out is floating point, like the DuckDB casts, floating point values
+// are converted only to floating point types at least as wide.
+template <typename In, typename Out>
+inline constexpr bool is_vector_conversion_v =
+    std::is_arithmetic_v<In> && std::is_arithmetic_v<Out> && !std::is_same_v<In, bool> &&
+    !std::is_same_v<Out, bool> &&
+    (std::is_integral_v<In> || (std::is_floating_point_v<Out> && sizeof(Out) >= sizeof(In)));
+
+template <typename T> struct vector_type
+{
+    using type = T;
+};
+
+template <typename T> struct vector_type<std::optional<T>>
+{
+    using type = T;
+};
+
+template <typename T> using vector_type_t = typename vector_type<T>::type;
+
+template <typename T>
+inline constexpr bool is_vectorized_v =
+    std::is_arithmetic_v<vector_type_t<T>> && !std::is_same_v<vector_type_t<T>, bool>;
+
+template <typename T> constexpr const char* numeric_name()
+{
+    if constexpr (std::is_same_v<T, int8_t>)
+        return "int8";
+    else if constexpr (std::is_same_v<T, int16_t>)
+        return "int16";
+    else if constexpr (std::is_same_v<T, int32_t>)
+        return "int32";
+    else if constexpr (std::is_same_v<T, int64_t>)
+        return "int64";
+    else if constexpr (std::is_same_v<T, uint8_t>)
+        return "uint8";
+    else if constexpr (std::is_same_v<T, uint16_t>)
+        return "uint16";
+    else if constexpr (std::is_same_v<T, uint32_t>)
+        return "uint32";
+    else if constexpr (std::is_same_v<T, uint64_t>)
+        return "uint64";
+    else if constexpr (std::is_same_v<T, float>)
+        return "float";
+    else
+        return "double";
+}
+
+// Fixed width types that are read directly from the chunk vectors when the column has
+// the matching logical type, other column types are converted through a Value.
+template <typename T> struct direct_read
+{
+    static constexpr bool enabled{false};
+};
+
+template <typename T, duckdb::LogicalTypeId Id> struct direct_read_as
+{
+    static constexpr bool enabled{true};
+    static constexpr duckdb::LogicalTypeId type_id{Id};
+    using storage = T;
+
+    static T convert(T value)
     {
-        const uint64_t ncols{result->ColumnCount()};
+        return value;
+    }
+};
 
-        if (sizeof...(Args) != ncols)
-            throw std::invalid_argument{
-                std::format("Invalid number of arguments, function has {} but query result has {}",
-                            sizeof...(Args), ncols)};
+template <> struct direct_read<bool> : direct_read_as<bool, duckdb::LogicalTypeId::BOOLEAN>
+{
+    static constexpr const char* name{"bool"};
+};
 
-        for (auto rowit{result->begin()}; rowit != result->end(); ++rowit)
-        {
-            std::apply(f, details::cast_row<Args...>(*rowit));
-        }
+template <> struct direct_read<int8_t> : direct_read_as<int8_t, duckdb::LogicalTypeId::TINYINT>
+{
+    static constexpr const char* name{"int8"};
+};
+
+template <> struct direct_read<int16_t> : direct_read_as<int16_t, duckdb::LogicalTypeId::SMALLINT>
+{
+    static constexpr const char* name{"int16"};
+};
+
+template <> struct direct_read<int32_t> : direct_read_as<int32_t, duckdb::LogicalTypeId::INTEGER>
+{
+    static constexpr const char* name{"int32"};
+};
+
+template <> struct direct_read<int64_t> : direct_read_as<int64_t, duckdb::LogicalTypeId::BIGINT>
+{
+    static constexpr const char* name{"int64"};
+};
+
+template <>
+struct direct_read<uint8_t> : direct_read_as<uint8_t, duckdb::LogicalTypeId::UTINYINT>
+{
+    static constexpr const char* name{"uint8"};
+};
+
+template <>
+struct direct_read<uint16_t> : direct_read_as<uint16_t, duckdb::LogicalTypeId::USMALLINT>
+{
+    static constexpr const char* name{"uint16"};
+};
+
+template <>
+struct direct_read<uint32_t> : direct_read_as<uint32_t, duckdb::LogicalTypeId::UINTEGER>
+{
+    static constexpr const char* name{"uint32"};
+};
+
+template <>
+struct direct_read<uint64_t> : direct_read_as<uint64_t, duckdb::LogicalTypeId::UBIGINT>
+{
+    static constexpr const char* name{"uint64"};
+};
+
+template <> struct direct_read<float> : direct_read_as<float, duckdb::LogicalTypeId::FLOAT>
+{
+    static constexpr const char* name{"float"};
+};
+
+template <> struct direct_read<double> : direct_read_as<double, duckdb::LogicalTypeId::DOUBLE>
+{
+    static constexpr const char* name{"double"};
+};
+
+template <>
+struct direct_read<duckdb::date_t> : direct_read_as<duckdb::date_t, duckdb::LogicalTypeId::DATE>
+{
+    static constexpr const char* name{"date"};
+};
+
+template <>
+struct direct_read<duckdb::dtime_t> : direct_read_as<duckdb::dtime_t, duckdb::LogicalTypeId::TIME>
+{
+    static constexpr const char* name{"time"};
+};
+
+template <>
+struct direct_read<duckdb::timestamp_t>
+    : direct_read_as<duckdb::timestamp_t, duckdb::LogicalTypeId::TIMESTAMP>
+{
+    static constexpr const char* name{"timestamp"};
+};
+
+template <>
+struct direct_read<duckdb::interval_t>
+    : direct_read_as<duckdb::interval_t, duckdb::LogicalTypeId::INTERVAL>
+{
+    static constexpr const char* name{"interval"};
+};
+
+template <>
+struct direct_read<Timestamp>
+    : direct_read_as<duckdb::timestamp_t, duckdb::LogicalTypeId::TIMESTAMP>
+{
+    static constexpr const char* name{"Timestamp"};
+
+    static Timestamp convert(duckdb::timestamp_t value)
+    {
+        return cast_to_timestamp(value);
     }
+};
 
-    return *f.template target<F>();
-}
+template <>
+struct direct_read<year_month_day> : direct_read_as<duckdb::date_t, duckdb::LogicalTypeId::DATE>
+{
+    static constexpr const char* name{"year_month_day"};
 
-} // namespace details
+    static year_month_day convert(duckdb::date_t value)
+    {
+        return cast_to_ymd(value);
+    }
+};
 
-template <typename F> auto for_each(std::unique_ptr<duckdb::QueryResult> result, F f)
+template <>
+struct direct_read<hh_mm_ss> : direct_read_as<duckdb::dtime_t, duckdb::LogicalTypeId::TIME>
 {
-    if (!result)
-        throw std::invalid_argument{"Invalid query result."};
+    static constexpr const char* name{"hh_mm_ss"};
 
-    if (result->HasError())
-        throw std::runtime_error(std::format("Query error {}", result->GetError()));
+    static hh_mm_ss convert(duckdb::dtime_t value)
+    {
+        return cast_to_hms(value);
+    }
+};
+
+// Reads a fixed width value from its vector without allocating, returns false if the
+// column type doesn't match and the value has to be converted through a Value.
+template <typename T> bool read_fixed(std::size_t colIdx, const ChunkRow& dbRow, T& outval)
+{
+    using Read = direct_read<vector_type_t<T>>;
+
+    if (dbRow.chunk.data[colIdx].GetType().id() != Read::type_id)
+        return false;
+
+    auto& format{dbRow.formats[colIdx]};
+    auto idx{format.sel->get_index(dbRow.row)};
+    if (!format.validity.RowIsValid(idx))
+    {
+        if constexpr (std::is_same_v<T, vector_type_t<T>>)
+            throw null_value_error(colIdx + 1, Read::name);
+        else
+            outval = std::nullopt;
+        return true;
+    }
+
+    using Storage = typename Read::storage;
+    outval = Read::convert(duckdb::UnifiedVectorFormat::GetData<Storage>(format)[idx]);
+    return true;
+}
+
+// Returns if In values need to be checked against the Out minimum and maximum values.
+template <typename In, typename Out> constexpr std::pair<bool, bool> needs_range_check()
+{
+    using InLimits = std::numeric_limits<In>;
+    using OutLimits = std::numeric_limits<Out>;
+
+    if constexpr (std::is_integral_v<In> && std::is_integral_v<Out>)
+        return {std::cmp_less(InLimits::lowest(), OutLimits::lowest()),
+                std::cmp_greater(InLimits::max(), OutLimits::max())};
+    else
+        return {false, false};
+}
+
+// Converts count values from In to Out and returns false if any of them is out of the Out
+// range. The loops are branch free so that they can be vectorized, out of range values are
+// detected with a single reduction at the end.
+template <typename In, typename Out>
+[[gnu::always_inline]] inline bool convert_values(const In* in, Out* out, std::size_t count)
+{
+    using OutLimits = std::numeric_limits<Out>;
+
+    constexpr bool checkMin{needs_range_check<In, Out>().first};
+    constexpr bool checkMax{needs_range_check<In, Out>().second};
+
+    if constexpr (!checkMin && !checkMax)
+    {
+        for (std::size_t i{0}; i < count; ++i)
+            out[i] = static_cast<Out>(in[i]);
+        return true;
+    }
+    else
+    {
+        unsigned outOfRange{0};
+        for (std::size_t i{0}; i < count; ++i)
+        {
+            if constexpr (checkMin)
+                outOfRange |= in[i] < static_cast<In>(OutLimits::lowest());
+            if constexpr (checkMax)
+                outOfRange |= in[i] > static_cast<In>(OutLimits::max());
+            out[i] = static_cast<Out>(in[i]);
+        }
+        return !outOfRange;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DUCKFOREACH_X86_DISPATCH
+
+template <typename In, typename Out>
+[[gnu::target("avx2")]] bool convert_values_avx2(const In* in, Out* out, std::size_t count)
+{
+    return convert_values(in, out, count);
+}
+
+template <typename In, typename Out>
+[[gnu::target("sse4.2")]] bool convert_values_sse4(const In* in, Out* out, std::size_t count)
+{
+    return convert_values(in, out, count);
+}
+
+enum class SimdLevel
+{
+    None,
+    Sse4,
+    Avx2
+};
+
+inline SimdLevel simd_level()
+{
+    static const SimdLevel level{[]
+                                 {
+                                     __builtin_cpu_init();
+                                     if (__builtin_cpu_supports("avx2"))
+                                         return SimdLevel::Avx2;
+                                     if (__builtin_cpu_supports("sse4.2"))
+                                         return SimdLevel::Sse4;
+                                     return SimdLevel::None;
+                                 }()};
+    return level;
+}
+#endif
+
+// Converts a vector of values selecting the widest instruction set at runtime.
+template <typename In, typename Out>
+bool convert_vector(const In* in, Out* out, std::size_t count)
+{
+#ifdef DUCKFOREACH_X86_DISPATCH
+    switch (simd_level())
+    {
+    case SimdLevel::Avx2:
+        return convert_values_avx2(in, out, count);
+    case SimdLevel::Sse4:
+        return convert_values_sse4(in, out, count);
+    default:
+        break;
+    }
+#endif
+    return convert_values(in, out, count);
+}
+
+// Values of a numeric column converted a vector at a time, buffers for other argument
+// types are empty.
+template <typename T, bool = is_vectorized_v<T>> struct VectorBuffer
+{
+};
+
+template <typename T> struct VectorBuffer<T, true>
+{
+    using Out = vector_type_t<T>;
+
+    // True if the column in the current chunk has been converted.
+    bool active{false};
+    std::vector<Out> values;
+    // The first row that cannot be converted and its error, the error is thrown when the
+    // row is reached so that previous rows are processed as with the Value conversion.
+    duckdb::idx_t errorRow{0};
+    std::string error;
+
+    template <typename In>
+    void convert(std::size_t colIdx, duckdb::Vector& vec, std::size_t count, std::size_t firstRow)
+    {
+        if constexpr (is_vector_conversion_v<In, Out>)
+        {
+            values.resize(STANDARD_VECTOR_SIZE);
+
+            auto in{duckdb::FlatVector::GetData<In>(vec)};
+            active = true;
+            errorRow = count;
+            if (convert_vector(in, values.data(), count))
+                return;
+
+            // Values of null rows are undefined so they may be out of range.
+            auto& validity{duckdb::FlatVector::Validity(vec)};
+            for (duckdb::idx_t row{0}; row < count; ++row)
+            {
+                bool inRange{true};
+                if constexpr (std::is_integral_v<In> && std::is_integral_v<Out>)
+                    inRange = std::in_range<Out>(in[row]);
+
+                if (validity.RowIsValid(row) && !inRange)
+                {
+                    errorRow = row;
+                    error = conversion_error(std::format("{}", in[row]), colIdx + 1,
+                                             firstRow + row + 1, vec.GetType().ToString(),
+                                             numeric_name<Out>());
+                    return;
+                }
+            }
+        }
+    }
+
+    void prepare(std::size_t colIdx, duckdb::DataChunk& chunk, std::size_t firstRow)
+    {
+        using duckdb::LogicalTypeId;
+
+        active = false;
+
+        auto& vec{chunk.data[colIdx]};
+        if (vec.GetVectorType() != duckdb::VectorType::FLAT_VECTOR)
+            return;
+
+        const auto count{chunk.size()};
+        switch (vec.GetType().id())
+        {
+        case LogicalTypeId::TINYINT:
+            return convert<int8_t>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::SMALLINT:
+            return convert<int16_t>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::INTEGER:
+            return convert<int32_t>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::BIGINT:
+            return convert<int64_t>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::UTINYINT:
+            return convert<uint8_t>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::USMALLINT:
+            return convert<uint16_t>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::UINTEGER:
+            return convert<uint32_t>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::UBIGINT:
+            return convert<uint64_t>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::FLOAT:
+            return convert<float>(colIdx, vec, count, firstRow);
+        case LogicalTypeId::DOUBLE:
+            return convert<double>(colIdx, vec, count, firstRow);
+        default:
+            return;
+        }
+    }
+
+    template <typename V> void read(std::size_t colIdx, const ChunkRow& dbRow, V& outval) const
+    {
+        if (dbRow.row == errorRow)
+            throw std::invalid_argument{error};
+
+        const bool isValid{dbRow.formats[colIdx].validity.RowIsValid(dbRow.row)};
+        if constexpr (std::is_same_v<V, Out>)
+        {
+            if (!isValid)
+                throw null_value_error(colIdx + 1, numeric_name<Out>());
+            outval = values[dbRow.row];
+        }
+        else
+        {
+            if (isValid)
+                outval = values[dbRow.row];
+            else
+                outval = std::nullopt;
+        }
+    }
+};
+
+template <typename... Cols> using VectorBuffers = std::tuple<VectorBuffer<Cols>...>;
+
+// Converts the value at colIdx, the column index is a function argument so that the same
+// instantiation is shared by all the rows and call sites with an Out column.
+template <typename Out>
+void cast_column(std::size_t colIdx,
+                 const ChunkRow& dbRow,
+                 const VectorBuffer<Out>& buffer,
+                 Out& outval)
+{
+    if constexpr (is_zero_copy_v<Out>)
+    {
+        read_value(colIdx, dbRow, outval);
+    }
+    else
+    {
+        bool converted{false};
+        if constexpr (is_vectorized_v<Out>)
+        {
+            if (buffer.active)
+            {
+                buffer.read(colIdx, dbRow, outval);
+                converted = true;
+            }
+        }
+        else if constexpr (std::is_same_v<vector_type_t<Out>, std::string>)
+        {
+            converted = read_string(colIdx, dbRow, outval);
+        }
+
+        if constexpr (direct_read<vector_type_t<Out>>::enabled)
+        {
+            if (!converted)
+                converted = read_fixed(colIdx, dbRow, outval);
+        }
+
+        if (!converted)
+        {
+            auto dbval{dbRow.chunk.GetValue(colIdx, dbRow.row)};
+            cast_value(colIdx + 1, dbRow.firstRow + dbRow.row + 1, dbval, outval);
+        }
+    }
+}
+
+template <typename... Cols, std::size_t... Is>
+void cast_row(const ChunkRow& dbRow,
+              const VectorBuffers<Cols...>& buffers,
+              std::tuple<Cols...>& outRow,
+              std::index_sequence<Is...>)
+{
+    (cast_column(Is, dbRow, std::get<Is>(buffers), std::get<Is>(outRow)), ...);
+}
+
+// Converts a row into outRow, strings in outRow keep their capacity across rows.
+template <typename... Cols>
+void cast_row(const ChunkRow& dbRow,
+              const VectorBuffers<Cols...>& buffers,
+              std::tuple<Cols...>& outRow)
+{
+    cast_row(dbRow, buffers, outRow, std::index_sequence_for<Cols...>{});
+}
+
+template <typename T>
+inline constexpr bool is_valid_argument_v =
+    std::is_same_v<T, bool> || std::is_same_v<T, std::optional<bool>> ||
+    std::is_same_v<T, int8_t> || std::is_same_v<T, std::optional<int8_t>> ||
+    std::is_same_v<T, int16_t> || std::is_same_v<T, std::optional<int16_t>> ||
+    std::is_same_v<T, int32_t> || std::is_same_v<T, std::optional<int32_t>> ||
+    std::is_same_v<T, int64_t> || std::is_same_v<T, std::optional<int64_t>> ||
+    std::is_same_v<T, uint8_t> || std::is_same_v<T, std::optional<uint8_t>> ||
+    std::is_same_v<T, uint16_t> || std::is_same_v<T, std::optional<uint16_t>> ||
+    std::is_same_v<T, uint32_t> || std::is_same_v<T, std::optional<uint32_t>> ||
+    std::is_same_v<T, uint64_t> || std::is_same_v<T, std::optional<uint64_t>> ||
+    std::is_same_v<T, double> || std::is_same_v<T, std::optional<double>> ||
+    std::is_same_v<T, float> || std::is_same_v<T, std::optional<float>> ||
+    std::is_same_v<T, std::string> || std::is_same_v<T, std::optional<std::string>> ||
+    std::is_same_v<T, duckdb::date_t> || std::is_same_v<T, std::optional<duckdb::date_t>> ||
+    std::is_same_v<T, duckdb::dtime_t> || std::is_same_v<T, std::optional<duckdb::dtime_t>> ||
+    std::is_same_v<T, duckdb::timestamp_t> ||
+    std::is_same_v<T, std::optional<duckdb::timestamp_t>> ||
+    std::is_same_v<T, duckdb::interval_t> || std::is_same_v<T, std::optional<duckdb::interval_t>> ||
+    std::is_same_v<T, Timestamp> || std::is_same_v<T, std::optional<Timestamp>> ||
+    std::is_same_v<T, year_month_day> || std::is_same_v<T, std::optional<year_month_day>> ||
+    std::is_same_v<T, hh_mm_ss> || std::is_same_v<T, std::optional<hh_mm_ss>> ||
+    std::is_same_v<T, std::span<const std::byte>> ||
+    std::is_same_v<T, std::optional<std::span<const std::byte>>> ||
+    std::is_same_v<T, BitView> || std::is_same_v<T, std::optional<BitView>> ||
+    std::is_same_v<T, std::string_view> || std::is_same_v<T, std::optional<std::string_view>>;
+
+// Checks one of the Args of a signature, the compiler error names the failing type as Arg.
+template <typename Arg> constexpr bool is_valid_arg()
+{
+    constexpr bool is_valid{is_valid_argument_v<std::decay_t<Arg>>};
+    static_assert(is_valid, "Invalid argument type Arg in the function arguments");
+    return is_valid;
+}
+
+template <typename... Args> constexpr bool is_valid_signature()
+{
+    constexpr bool is_valid_args{(is_valid_arg<Args>() && ...)};
+
+    static_assert(sizeof...(Args) > 0, "A function needs at least one argument");
+
+    return sizeof...(Args) > 0 && is_valid_args;
+}
+
+// Fetches chunks from a query result one at a time.
+class ResultSource
+{
+public:
+    explicit ResultSource(duckdb::QueryResult& result)
+        : mResult{result}
+    {
+    }
+
+    duckdb::DataChunk* next()
+    {
+        mChunk = mResult.Fetch();
+        return mChunk.get();
+    }
+
+private:
+    duckdb::QueryResult& mResult;
+    std::unique_ptr<duckdb::DataChunk> mChunk;
+};
+
+// Estimated memory used by a chunk: the vectors buffers plus the strings stored out of
+// line, children of nested types are not included.
+inline std::size_t chunk_bytes(duckdb::DataChunk& chunk)
+{
+    std::size_t bytes{0};
+    for (auto& vec : chunk.data)
+    {
+        auto ptype{vec.GetType().InternalType()};
+        bytes += STANDARD_VECTOR_SIZE * duckdb::GetTypeIdSize(ptype);
+
+        if (ptype == duckdb::PhysicalType::VARCHAR)
+        {
+            duckdb::UnifiedVectorFormat format;
+            vec.ToUnifiedFormat(chunk.size(), format);
+            auto strs{duckdb::UnifiedVectorFormat::GetData<duckdb::string_t>(format)};
+            for (duckdb::idx_t row{0}; row < chunk.size(); ++row)
+            {
+                auto idx{format.sel->get_index(row)};
+                if (format.validity.RowIsValid(idx) && !strs[idx].IsInlined())
+                    bytes += strs[idx].GetSize();
+            }
+        }
+    }
+    return bytes;
+}
+
+// Fetches chunks on a producer thread that runs ahead of the function object, the producer
+// blocks when maxChunks chunks, including the one being processed, are in memory.
+//
+// Processed chunks are recycled: materialized results are scanned into the buffers of
+// processed chunks, DuckDB stream results return a new chunk on each fetch so processed
+// chunks are released instead.
+class PrefetchSource
+{
+public:
+    PrefetchSource(duckdb::QueryResult& result, std::size_t maxChunks)
+        : mResult{result}
+        , mMaxChunks{maxChunks}
+    {
+        if (maxChunks == 0)
+            throw std::invalid_argument{"Stream max_chunks must be greater than zero."};
+
+        if (result.type == duckdb::QueryResultType::MATERIALIZED_RESULT)
+        {
+            mCollection = &result.Cast<duckdb::MaterializedQueryResult>().Collection();
+            mCollection->InitializeScan(mScanState,
+                                        duckdb::ColumnDataScanProperties::DISALLOW_ZERO_COPY);
+        }
+    }
+
+    PrefetchSource(const PrefetchSource&) = delete;
+    PrefetchSource& operator=(const PrefetchSource&) = delete;
+
+    ~PrefetchSource()
+    {
+        {
+            std::lock_guard lock{mMutex};
+            mStop = true;
+        }
+        mCond.notify_all();
+
+        if (mThread.joinable())
+            mThread.join();
+    }
+
+    // Starts fetching chunks, otherwise the first call to next does.
+    void start()
+    {
+        if (!mThread.joinable())
+            mThread = std::thread{[this] { produce(); }};
+    }
+
+    duckdb::DataChunk* next()
+    {
+        start();
+
+        std::unique_lock lock{mMutex};
+
+        if (mCurrent)
+        {
+            mBufferedBytes -= mCurrentBytes;
+            if (mCollection)
+                mFree.push_back(std::move(mCurrent));
+            mCurrent.reset();
+            mCond.notify_all();
+        }
+
+        mCond.wait(lock, [this] { return !mReady.empty() || mDone; });
+        if (mReady.empty())
+        {
+            if (mError)
+                std::rethrow_exception(mError);
+            return nullptr;
+        }
+
+        std::tie(mCurrent, mCurrentBytes) = std::move(mReady.front());
+        mReady.pop_front();
+        mCond.notify_all();
+
+        ++mStats.chunks;
+        mStats.rows += mCurrent->size();
+        return mCurrent.get();
+    }
+
+    StreamStats stats() const
+    {
+        std::lock_guard lock{mMutex};
+        return mStats;
+    }
+
+private:
+    std::size_t buffered() const
+    {
+        return mReady.size() + (mCurrent ? 1 : 0);
+    }
+
+    std::unique_ptr<duckdb::DataChunk> fetch(std::unique_ptr<duckdb::DataChunk> chunk)
+    {
+        if (!mCollection)
+            return mResult.Fetch();
+
+        if (!chunk)
+        {
+            chunk = std::make_unique<duckdb::DataChunk>();
+            mCollection->InitializeScanChunk(*chunk);
+        }
+
+        if (!mCollection->Scan(mScanState, *chunk))
+            return nullptr;
+        return chunk;
+    }
+
+    void produce()
+    {
+        for (;;)
+        {
+            std::unique_ptr<duckdb::DataChunk> chunk;
+
+            {
+                std::unique_lock lock{mMutex};
+                mCond.wait(lock, [this] { return mStop || buffered() < mMaxChunks; });
+                if (mStop)
+                    return;
+
+                if (!mFree.empty())
+                {
+                    chunk = std::move(mFree.back());
+                    mFree.pop_back();
+                }
+            }
+
+            std::size_t bytes{0};
+            try
+            {
+                chunk = fetch(std::move(chunk));
+                if (chunk)
+                    bytes = chunk_bytes(*chunk);
+            }
+            catch (...)
+            {
+                std::lock_guard lock{mMutex};
+                mError = std::current_exception();
+                chunk.reset();
+            }
+
+            const bool done{!chunk};
+
+            {
+                std::lock_guard lock{mMutex};
+                if (!done)
+                {
+                    mReady.emplace_back(std::move(chunk), bytes);
+                    mBufferedBytes += bytes;
+                    auto& stats{mStats};
+                    stats.peak_buffered_chunks = std::max(stats.peak_buffered_chunks, buffered());
+                    stats.peak_buffered_bytes = std::max(stats.peak_buffered_bytes, mBufferedBytes);
+                }
+                else
+                {
+                    mDone = true;
+                }
+            }
+            mCond.notify_all();
+
+            if (done)
+                return;
+        }
+    }
+
+    duckdb::QueryResult& mResult;
+    const std::size_t mMaxChunks;
+    duckdb::ColumnDataCollection* mCollection{nullptr};
+    duckdb::ColumnDataScanState mScanState;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<std::pair<std::unique_ptr<duckdb::DataChunk>, std::size_t>> mReady;
+    std::vector<std::unique_ptr<duckdb::DataChunk>> mFree;
+    std::unique_ptr<duckdb::DataChunk> mCurrent;
+    std::size_t mCurrentBytes{0};
+    std::size_t mBufferedBytes{0};
+    bool mDone{false};
+    bool mStop{false};
+    std::exception_ptr mError;
+    StreamStats mStats;
+    std::thread mThread;
+};
+
+template <typename... Args> void check_columns(std::size_t ncols)
+{
+    if (sizeof...(Args) != ncols)
+        throw std::invalid_argument{
+            std::format("Invalid number of arguments, function has {} but query result has {}",
+                        sizeof...(Args), ncols)};
+}
+
+template <typename... Args> void check_columns(duckdb::QueryResult& result)
+{
+    check_columns<Args...>(result.ColumnCount());
+}
+
+// Passes a converted value to an Args parameter, values are moved only into value and
+// rvalue reference parameters so that lvalue references see the reused row storage.
+template <typename Arg, typename T> decltype(auto) forward_arg(T& value)
+{
+    if constexpr (std::is_lvalue_reference_v<Arg>)
+        return static_cast<T&>(value);
+    else
+        return static_cast<T&&>(value);
+}
+
+// Same as above but copies the value when keep is true, for values that are still needed
+// after the call like the key of the last merged row.
+template <typename Arg, typename T> decltype(auto) forward_arg(T& value, bool keep)
+{
+    if constexpr (std::is_lvalue_reference_v<Arg>)
+        return static_cast<T&>(value);
+    else
+        return keep ? T(value) : T(std::move(value));
+}
+
+// Converts chunk rows to the Args types, numeric columns are converted a vector at a time
+// into buffers that are reused across chunks. The row tuple is reused across rows and
+// chunks, so after the first rows a conversion to fixed width types, string_view, or
+// const std::string& arguments does not allocate.
+template <typename... Args> class RowConverter
+{
+public:
+    using Row = std::tuple<std::decay_t<Args>...>;
+
+    // Calls f with each row in the chunk, firstRow is the index of the first chunk row in
+    // the result and it is used for error messages.
+    template <typename F> void for_each_row(duckdb::DataChunk& chunk, std::size_t firstRow, F& f)
+    {
+        begin_chunk(chunk, firstRow);
+        for (duckdb::idx_t row{0}; row < chunk.size(); ++row)
+        {
+            auto& values{convert_row(chunk, row)};
+            [&]<std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                f(forward_arg<Args>(std::get<Is>(values))...);
+            }(std::index_sequence_for<Args...>{});
+        }
+    }
+
+    // Prepares the chunk for convert_row calls.
+    void begin_chunk(duckdb::DataChunk& chunk, std::size_t firstRow)
+    {
+        prepare(chunk, firstRow, std::index_sequence_for<Args...>{});
+        mFormats = chunk.ToUnifiedFormat();
+        mFirstRow = firstRow;
+    }
+
+    // Converts a row, the returned tuple is overwritten by the next call and its values can
+    // be swapped out to keep them.
+    Row& convert_row(duckdb::DataChunk& chunk, duckdb::idx_t row)
+    {
+        ChunkRow dbRow{chunk, mFormats.get(), row, mFirstRow};
+        cast_row(dbRow, mBuffers, mRow);
+        return mRow;
+    }
+
+private:
+    template <std::size_t... Is>
+    void prepare(duckdb::DataChunk& chunk, std::size_t firstRow, std::index_sequence<Is...>)
+    {
+        (prepare_column<Is>(chunk, firstRow), ...);
+    }
+
+    template <std::size_t ColIdx>
+    void prepare_column(duckdb::DataChunk& chunk, std::size_t firstRow)
+    {
+        auto& buffer{std::get<ColIdx>(mBuffers)};
+        if constexpr (requires { buffer.prepare(ColIdx, chunk, firstRow); })
+            buffer.prepare(ColIdx, chunk, firstRow);
+    }
+
+    VectorBuffers<std::decay_t<Args>...> mBuffers;
+    decltype(std::declval<duckdb::DataChunk&>().ToUnifiedFormat()) mFormats;
+    std::size_t mFirstRow{0};
+    Row mRow;
+};
+
+inline void check_stream_error(duckdb::QueryResult& result)
+{
+    // Stream results report execution errors by ending the stream.
+    if (result.HasError())
+        throw std::runtime_error(std::format("Query error {}", result.GetError()));
+}
+
+template <typename F, typename Source, typename R, typename... Args>
+auto for_each_impl(duckdb::QueryResult& result, Source& source, std::function<R(Args...)>&& f)
+{
+    if constexpr (details::is_valid_signature<Args...>())
+    {
+        check_columns<Args...>(result);
+
+        RowConverter<Args...> converter;
+        std::size_t firstRow{0};
+        while (auto chunk{source.next()})
+        {
+            converter.for_each_row(*chunk, firstRow, f);
+            firstRow += chunk->size();
+        }
+
+        // A cancelled query ends with an interrupt error.
+        bool cancelled{false};
+        if constexpr (requires { source.cancelled(); })
+            cancelled = source.cancelled();
+
+        if (!cancelled)
+            check_stream_error(result);
+    }
+
+    return *f.template target<F>();
+}
+
+// Reports progress and stops at the next chunk when the token is cancelled, the token
+// interrupts the query of stream results while it is attached.
+template <typename Source> class MonitoredSource
+{
+public:
+    MonitoredSource(duckdb::QueryResult& result, Source& source, const StreamOptions& options)
+        : mSource{source}
+        , mToken{options.cancellation}
+        , mProgress{options.progress}
+    {
+        if (result.type == duckdb::QueryResultType::STREAM_RESULT)
+            mContext = result.Cast<duckdb::StreamQueryResult>().context.get();
+        else
+            mTotalRows = result.Cast<duckdb::MaterializedQueryResult>().RowCount();
+
+        if (mToken)
+            mToken->attach(mContext);
+    }
+
+    MonitoredSource(const MonitoredSource&) = delete;
+    MonitoredSource& operator=(const MonitoredSource&) = delete;
+
+    ~MonitoredSource()
+    {
+        if (mToken)
+            mToken->attach(nullptr);
+    }
+
+    duckdb::DataChunk* next()
+    {
+        if (cancelled())
+            return nullptr;
+
+        auto previous{mChunk};
+        try
+        {
+            mChunk = mSource.next();
+        }
+        catch (...)
+        {
+            // Fetching an interrupted stream fails.
+            if (cancelled())
+                return nullptr;
+            throw;
+        }
+
+        // The previous chunk is reported after the fetch to know if it was the last one.
+        if (previous && mProgress)
+            report(!mChunk);
+
+        if (mChunk)
+        {
+            ++mProgressInfo.chunks;
+            mProgressInfo.rows += mChunk->size();
+        }
+        return mChunk;
+    }
+
+    bool cancelled() const
+    {
+        return mToken && mToken->cancelled();
+    }
+
+private:
+    void report(bool last)
+    {
+        if (last)
+            mProgressInfo.percent = 100;
+        else if (!mContext)
+            mProgressInfo.percent = 100.0 * mProgressInfo.rows / mTotalRows;
+        else
+        {
+            // The query progress is reset when the query completes ahead of the rows.
+            mProgressInfo.percent =
+                std::max(mProgressInfo.percent, mContext->GetQueryProgress().GetPercentage());
+        }
+        mProgress(mProgressInfo);
+    }
+
+    Source& mSource;
+    CancellationToken* mToken;
+    const std::function<void(const Progress&)>& mProgress;
+    duckdb::ClientContext* mContext{nullptr};
+    std::size_t mTotalRows{0};
+    Progress mProgressInfo;
+    duckdb::DataChunk* mChunk{nullptr};
+};
+
+inline void check_result(const std::unique_ptr<duckdb::QueryResult>& result)
+{
+    if (!result)
+        throw std::invalid_argument{"Invalid query result."};
+
+    if (result->HasError())
+        throw std::runtime_error(std::format("Query error {}", result->GetError()));
+}
+
+// Releases an Arrow structure unless its ownership has been moved out.
+template <typename T> struct ArrowRelease
+{
+    T& value;
+
+    ~ArrowRelease()
+    {
+        if (value.release)
+            value.release(&value);
+    }
+};
+
+} // namespace details
+
+template <typename F> auto for_each(std::unique_ptr<duckdb::QueryResult> result, F f)
+{
+    details::check_result(result);
+
+    details::ResultSource source{*result};
+    return details::for_each_impl<F>(*result, source, std::function{f});
+}
+
+// Streaming for_each, chunks are fetched ahead of the function object on a separate thread
+// keeping at most options.max_chunks chunks in memory. Use it with a result returned by
+// duckdb::Connection::SendQuery to keep memory bounded regardless of the result size.
+template <typename F>
+auto for_each(std::unique_ptr<duckdb::QueryResult> result, F f, const StreamOptions& options)
+{
+    details::check_result(result);
+
+    details::PrefetchSource prefetch{*result, options.max_chunks};
+    details::MonitoredSource source{*result, prefetch, options};
+    auto fn{details::for_each_impl<F>(*result, source, std::function{f})};
+
+    if (options.stats)
+        *options.stats = prefetch.stats();
+
+    return fn;
+}
+
+// Calls f(ArrowArray&, ArrowSchema&) for each chunk in the result converted to an Arrow
+// array, the schema is the same for all the arrays.
+//
+// Ownership follows the Arrow C data interface, f can move the array or the schema out by
+// copying the struct and setting its release callback to nullptr, otherwise they are
+// released when f returns and at the end of the iteration respectively.
+template <typename F> F for_each_arrow(std::unique_ptr<duckdb::QueryResult> result, F f)
+{
+    details::check_result(result);
+
+    const auto& props{result->client_properties};
+
+    ArrowSchema schema;
+    schema.Init();
+    details::ArrowRelease<ArrowSchema> releaseSchema{schema};
+    duckdb::ArrowConverter::ToArrowSchema(&schema, result->types, result->names, props);
+
+    while (auto chunk{result->Fetch()})
+    {
+        ArrowArray array;
+        array.Init();
+        details::ArrowRelease<ArrowArray> releaseArray{array};
+        duckdb::ArrowConverter::ToArrowArray(*chunk, &array, props);
+
+        // The schema may have been moved out by a previous call.
+        if (!schema.release)
+            duckdb::ArrowConverter::ToArrowSchema(&schema, result->types, result->names, props);
+
+        f(array, schema);
+    }
+
+    return f;
+}
+
+// A typed view of a column in a result chunk, it references the chunk data so it is valid
+// only for the duration of the visitor call.
+//
+// T is the column physical type, use type() for values whose meaning depends on the logical
+// type, for example the unit of timestamp_t values or the scale of decimals. Columns with
+// types that have no flat representation (nested types, enums, decimals) use T =
+// duckdb::Value and are converted one value at a time.
+template <typename T> class ColumnView
+{
+public:
+    ColumnView(std::size_t index,
+               const std::string& name,
+               duckdb::Vector& vector,
+               std::size_t size,
+               std::size_t firstRow)
+        : mIndex{index}
+        , mName{&name}
+        , mVector{&vector}
+        , mSize{size}
+        , mFirstRow{firstRow}
+    {
+        if constexpr (!std::is_same_v<T, duckdb::Value>)
+            mValues = {duckdb::FlatVector::GetData<T>(vector), size};
+    }
+
+    // Index of the column in the result.
+    std::size_t index() const
+    {
+        return mIndex;
+    }
+
+    const std::string& name() const
+    {
+        return *mName;
+    }
+
+    const duckdb::LogicalType& type() const
+    {
+        return mVector->GetType();
+    }
+
+    // Number of rows in the chunk.
+    std::size_t size() const
+    {
+        return mSize;
+    }
+
+    // Index in the result of the first row in the chunk.
+    std::size_t first_row() const
+    {
+        return mFirstRow;
+    }
+
+    // The column values, values for null rows are undefined.
+    std::span<const T> values() const
+        requires(!std::is_same_v<T, duckdb::Value>)
+    {
+        return mValues;
+    }
+
+    bool is_null(std::size_t row) const
+    {
+        return !duckdb::FlatVector::Validity(*mVector).RowIsValid(row);
+    }
+
+    bool has_nulls() const
+    {
+        return !duckdb::FlatVector::Validity(*mVector).CheckAllValid(mSize);
+    }
+
+    // The value at the given row, strings are returned as std::string_view.
+    auto operator[](std::size_t row) const
+    {
+        if constexpr (std::is_same_v<T, duckdb::Value>)
+            return mVector->GetValue(row);
+        else if constexpr (std::is_same_v<T, duckdb::string_t>)
+            return std::string_view{mValues[row].GetData(), mValues[row].GetSize()};
+        else
+            return mValues[row];
+    }
+
+private:
+    std::size_t mIndex;
+    const std::string* mName;
+    duckdb::Vector* mVector;
+    std::span<const T> mValues;
+    std::size_t mSize;
+    std::size_t mFirstRow;
+};
+
+using Column = std::variant<ColumnView<bool>,
+                            ColumnView<int8_t>,
+                            ColumnView<int16_t>,
+                            ColumnView<int32_t>,
+                            ColumnView<int64_t>,
+                            ColumnView<uint8_t>,
+                            ColumnView<uint16_t>,
+                            ColumnView<uint32_t>,
+                            ColumnView<uint64_t>,
+                            ColumnView<float>,
+                            ColumnView<double>,
+                            ColumnView<duckdb::hugeint_t>,
+                            ColumnView<duckdb::uhugeint_t>,
+                            ColumnView<duckdb::date_t>,
+                            ColumnView<duckdb::dtime_t>,
+                            ColumnView<duckdb::timestamp_t>,
+                            ColumnView<duckdb::interval_t>,
+                            ColumnView<duckdb::string_t>,
+                            ColumnView<duckdb::Value>>;
+
+namespace details {
+
+inline Column make_column(std::size_t index,
+                          const std::string& name,
+                          duckdb::Vector& vector,
+                          std::size_t size,
+                          std::size_t firstRow)
+{
+    using duckdb::LogicalTypeId;
+
+    auto view = [&]<typename T>(std::type_identity<T>) -> Column
+    { return ColumnView<T>{index, name, vector, size, firstRow}; };
+
+    switch (vector.GetType().id())
+    {
+    case LogicalTypeId::BOOLEAN:
+        return view(std::type_identity<bool>{});
+    case LogicalTypeId::TINYINT:
+        return view(std::type_identity<int8_t>{});
+    case LogicalTypeId::SMALLINT:
+        return view(std::type_identity<int16_t>{});
+    case LogicalTypeId::INTEGER:
+        return view(std::type_identity<int32_t>{});
+    case LogicalTypeId::BIGINT:
+        return view(std::type_identity<int64_t>{});
+    case LogicalTypeId::UTINYINT:
+        return view(std::type_identity<uint8_t>{});
+    case LogicalTypeId::USMALLINT:
+        return view(std::type_identity<uint16_t>{});
+    case LogicalTypeId::UINTEGER:
+        return view(std::type_identity<uint32_t>{});
+    case LogicalTypeId::UBIGINT:
+        return view(std::type_identity<uint64_t>{});
+    case LogicalTypeId::FLOAT:
+        return view(std::type_identity<float>{});
+    case LogicalTypeId::DOUBLE:
+        return view(std::type_identity<double>{});
+    case LogicalTypeId::HUGEINT:
+        return view(std::type_identity<duckdb::hugeint_t>{});
+    case LogicalTypeId::UHUGEINT:
+        return view(std::type_identity<duckdb::uhugeint_t>{});
+    case LogicalTypeId::DATE:
+        return view(std::type_identity<duckdb::date_t>{});
+    case LogicalTypeId::TIME:
+        return view(std::type_identity<duckdb::dtime_t>{});
+    case LogicalTypeId::TIMESTAMP:
+    case LogicalTypeId::TIMESTAMP_SEC:
+    case LogicalTypeId::TIMESTAMP_MS:
+    case LogicalTypeId::TIMESTAMP_NS:
+    case LogicalTypeId::TIMESTAMP_TZ:
+        return view(std::type_identity<duckdb::timestamp_t>{});
+    case LogicalTypeId::INTERVAL:
+        return view(std::type_identity<duckdb::interval_t>{});
+    case LogicalTypeId::VARCHAR:
+    case LogicalTypeId::BLOB:
+    case LogicalTypeId::BIT:
+        return view(std::type_identity<duckdb::string_t>{});
+    default:
+        return view(std::type_identity<duckdb::Value>{});
+    }
+}
+
+} // namespace details
+
+// Calls visitor(const ColumnView<T>&) for each column of each chunk in the result, the
+// columns of a chunk are visited in order. The column type is resolved once per column
+// and chunk so visitors can process the values with typed loops, use it when the result
+// schema is not known at compile time.
+template <typename Visitor>
+Visitor for_each_dynamic(std::unique_ptr<duckdb::QueryResult> result, Visitor visitor)
+{
+    details::check_result(result);
+
+    std::size_t firstRow{0};
+    while (auto chunk{result->Fetch()})
+    {
+        chunk->Flatten();
+        for (std::size_t col{0}; col < chunk->ColumnCount(); ++col)
+        {
+            auto column{details::make_column(col, result->names[col], chunk->data[col],
+                                             chunk->size(), firstRow)};
+            std::visit(visitor, column);
+        }
+        firstRow += chunk->size();
+    }
+
+    details::check_stream_error(*result);
+
+    return visitor;
+}
+
+namespace details {
+
+// A bounded multi-producer multi-consumer queue, push blocks when the queue is full and pop
+// blocks when it is empty. After close push fails and pop drains the remaining items.
+template <typename T> class BlockingQueue
+{
+public:
+    explicit BlockingQueue(std::size_t capacity)
+        : mCapacity{std::max<std::size_t>(capacity, 1)}
+    {
+    }
+
+    bool push(T item)
+    {
+        std::unique_lock lock{mMutex};
+        mNotFull.wait(lock, [this] { return mClosed || mItems.size() < mCapacity; });
+        if (mClosed)
+            return false;
+
+        mItems.push_back(std::move(item));
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop()
+    {
+        std::unique_lock lock{mMutex};
+        mNotEmpty.wait(lock, [this] { return mClosed || !mItems.empty(); });
+        if (mItems.empty())
+            return std::nullopt;
+
+        auto item{std::move(mItems.front())};
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return item;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard lock{mMutex};
+            mClosed = true;
+        }
+        mNotFull.notify_all();
+        mNotEmpty.notify_all();
+    }
+
+private:
+    const std::size_t mCapacity;
+    std::mutex mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+    std::deque<T> mItems;
+    bool mClosed{false};
+};
+
+// Runs work(index) on nthreads threads, if any of them throws the first exception is
+// rethrown after all threads have completed and onError is called to unblock the others.
+template <typename Work, typename OnError>
+void run_threads(std::size_t nthreads, Work&& work, OnError&& onError)
+{
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads);
+    for (std::size_t i{0}; i < nthreads; ++i)
+    {
+        threads.emplace_back(
+            [&, i]
+            {
+                try
+                {
+                    work(i);
+                }
+                catch (...)
+                {
+                    {
+                        std::lock_guard lock{errorMutex};
+                        if (!error)
+                            error = std::current_exception();
+                    }
+                    onError();
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+inline std::size_t num_threads(std::size_t nthreads)
+{
+    return nthreads ? nthreads : std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+// A hash table with open addressing and linear probing used for thread local aggregations.
+template <typename K, typename V> class FlatMap
+{
+public:
+    FlatMap()
+        : mSlots(16)
+    {
+    }
+
+    V& find_or_insert(const K& key, const V& init)
+    {
+        if ((mSize + 1) * 2 > mSlots.size())
+            grow();
+
+        auto& slot{mSlots[find_slot(key)]};
+        if (!slot)
+        {
+            slot.emplace(key, init);
+            ++mSize;
+        }
+        return slot->second;
+    }
+
+    std::size_t size() const
+    {
+        return mSize;
+    }
+
+    template <typename Fn> void for_each(Fn&& fn)
+    {
+        for (auto& slot : mSlots)
+            if (slot)
+                fn(slot->first, slot->second);
+    }
+
+private:
+    std::size_t find_slot(const K& key) const
+    {
+        // Fibonacci hashing spreads integer keys that std::hash maps to themselves.
+        const std::size_t mask{mSlots.size() - 1};
+        std::size_t idx{(std::hash<K>{}(key) * 0x9E3779B97F4A7C15ull) >> mShift};
+        while (mSlots[idx] && !(mSlots[idx]->first == key))
+            idx = (idx + 1) & mask;
+        return idx;
+    }
+
+    void grow()
+    {
+        std::vector<std::optional<std::pair<K, V>>> slots(mSlots.size() * 2);
+        std::swap(slots, mSlots);
+        --mShift;
+
+        for (auto& slot : slots)
+            if (slot)
+                mSlots[find_slot(slot->first)] = std::move(slot);
+    }
+
+    std::vector<std::optional<std::pair<K, V>>> mSlots;
+    std::size_t mSize{0};
+    int mShift{64 - 4};
+};
+
+template <typename Fold, typename Agg, typename Row, std::size_t... Is>
+void fold_row(Fold& fold, Agg& agg, Row& row, std::index_sequence<Is...>)
+{
+    fold(agg, std::move(std::get<Is + 1>(row))...);
+}
+
+template <typename Key, typename Agg, typename Fold, typename Merge, typename... Cols>
+auto reduce_by_impl(duckdb::QueryResult& result,
+                    const Agg& init,
+                    Fold& fold,
+                    Merge& merge,
+                    std::size_t nthreads,
+                    std::function<void(Agg&, Cols...)>*)
+{
+    std::unordered_map<Key, Agg> aggs;
+
+    if constexpr (is_valid_signature<Key, Cols...>())
+    {
+        check_columns<Key, Cols...>(result);
+
+        nthreads = num_threads(nthreads);
+        std::vector<FlatMap<Key, Agg>> tables(nthreads);
+        BlockingQueue<std::pair<std::unique_ptr<duckdb::DataChunk>, std::size_t>> chunks{
+            nthreads * 2};
+
+        auto work = [&](std::size_t idx)
+        {
+            auto& table{tables[idx]};
+            RowConverter<Key, Cols...> converter;
+            auto foldRow = [&](auto&&... cols)
+            {
+                auto row{std::forward_as_tuple(cols...)};
+                auto& agg{table.find_or_insert(std::get<0>(row), init)};
+                fold_row(fold, agg, row, std::index_sequence_for<Cols...>{});
+            };
+
+            while (auto chunk{chunks.pop()})
+                converter.for_each_row(*chunk->first, chunk->second, foldRow);
+        };
+
+        // The last thread fetches the chunks and the workers convert and fold them.
+        run_threads(
+            nthreads + 1,
+            [&](std::size_t idx)
+            {
+                if (idx < nthreads)
+                {
+                    work(idx);
+                    return;
+                }
+
+                std::size_t firstRow{0};
+                while (auto chunk{result.Fetch()})
+                {
+                    auto size{chunk->size()};
+                    if (!chunks.push({std::move(chunk), firstRow}))
+                        break;
+                    firstRow += size;
+                }
+                chunks.close();
+                check_stream_error(result);
+            },
+            [&] { chunks.close(); });
+
+        for (auto& table : tables)
+        {
+            table.for_each(
+                [&](const Key& key, Agg& agg)
+                {
+                    auto [it, inserted]{aggs.try_emplace(key, std::move(agg))};
+                    if (!inserted)
+                        merge(it->second, std::as_const(agg));
+                });
+        }
+    }
+
+    return aggs;
+}
+
+} // namespace details
+
+// Groups rows by the first column and folds the remaining columns into a per key
+// aggregate, returns a map from keys to aggregates.
+//
+// fold(Agg&, Cols...) is called with the key aggregate, initialized to init, and the other
+// row values. Chunks are converted and folded on nthreads threads (0 for the number of
+// cores) each with its own hash table, merge(Agg&, const Agg&) combines the aggregates of
+// the same key computed on different threads.
+template <typename Key, typename Agg, typename Fold, typename Merge>
+std::unordered_map<Key, Agg> reduce_by(std::unique_ptr<duckdb::QueryResult> result,
+                                       Agg init,
+                                       Fold fold,
+                                       Merge merge,
+                                       std::size_t nthreads = 0)
+{
+    static_assert(!details::is_zero_copy_v<Key>,
+                  "Keys are kept after their chunks are freed, use an owning key type");
+
+    details::check_result(result);
+
+    using FoldFunction = decltype(std::function{fold});
+    return details::reduce_by_impl<Key>(*result, init, fold, merge, nthreads,
+                                        static_cast<FoldFunction*>(nullptr));
+}
+
+// Text formats supported by write_csv.
+enum class TextFormat
+{
+    csv,
+    tsv,
+    jsonl
+};
+
+// Options for write_csv.
+struct WriteOptions
+{
+    TextFormat format{TextFormat::csv};
+    // Write a first line with the column names, ignored for JSON lines.
+    bool header{true};
+    // Text for NULL values in CSV and TSV output, JSON lines use null.
+    std::string null_value{};
+    // Size of the output buffer, the sink is written only when the buffer is full.
+    std::size_t buffer_size{1 << 20};
+};
+
+namespace details {
+
+inline constexpr std::size_t MIN_TEXT_BUFFER{1024};
+
+// Upper bound of the formatted size of a number, a date or a timestamp.
+inline constexpr std::size_t MAX_FIELD_SIZE{64};
+
+inline constexpr auto DIGIT_PAIRS = []
+{
+    std::array<char, 200> digits{};
+    for (std::size_t i{0}; i < 100; ++i)
+    {
+        digits[2 * i] = static_cast<char>('0' + i / 10);
+        digits[2 * i + 1] = static_cast<char>('0' + i % 10);
+    }
+    return digits;
+}();
+
+inline char* write_2digits(char* out, int64_t value)
+{
+    out[0] = DIGIT_PAIRS[2 * value];
+    out[1] = DIGIT_PAIRS[2 * value + 1];
+    return out + 2;
+}
+
+// Formats a date as YYYY-MM-DD, dates outside years 1 to 9999 and infinities use the DuckDB
+// formatting.
+inline char* write_date(char* out, duckdb::date_t date)
+{
+    int32_t year{0}, month{0}, day{0};
+    if (date != duckdb::date_t::infinity() && date != duckdb::date_t::ninfinity())
+        duckdb::Date::Convert(date, year, month, day);
+
+    if (year < 1 || year > 9999)
+    {
+        auto str{duckdb::Value::DATE(date).ToString()};
+        return std::copy_n(str.data(), std::min(str.size(), MAX_FIELD_SIZE / 2), out);
+    }
+
+    out = write_2digits(out, year / 100);
+    out = write_2digits(out, year % 100);
+    *out++ = '-';
+    out = write_2digits(out, month);
+    *out++ = '-';
+    return write_2digits(out, day);
+}
+
+// Accumulates formatted text and passes it to the sink in buffer sized writes.
+template <typename Sink> class TextBuffer
+{
+public:
+    TextBuffer(Sink sink, std::size_t capacity)
+        : mSink{std::move(sink)}
+        , mData{std::make_unique_for_overwrite<char[]>(capacity)}
+        , mCapacity{capacity}
+    {
+    }
+
+    // Returns space for at least MAX_FIELD_SIZE characters, call commit with the end of
+    // the written text.
+    char* reserve()
+    {
+        if (mCapacity - mSize < MAX_FIELD_SIZE)
+            flush();
+        return mData.get() + mSize;
+    }
+
+    void commit(char* end)
+    {
+        mSize = end - mData.get();
+    }
+
+    void put(char c)
+    {
+        if (mSize == mCapacity)
+            flush();
+        mData[mSize++] = c;
+    }
+
+    void append(std::string_view str)
+    {
+        while (!str.empty())
+        {
+            if (mSize == mCapacity)
+                flush();
+
+            auto size{std::min(str.size(), mCapacity - mSize)};
+            std::copy_n(str.data(), size, mData.get() + mSize);
+            mSize += size;
+            str.remove_prefix(size);
+        }
+    }
+
+    void flush()
+    {
+        if (mSize > 0)
+            mSink(mData.get(), mSize);
+        mSize = 0;
+    }
+
+private:
+    Sink mSink;
+    std::unique_ptr<char[]> mData;
+    std::size_t mCapacity;
+    std::size_t mSize{0};
+};
+
+// Formats rows of typed columns as CSV, TSV or JSON lines.
+template <typename Sink> class TextWriter
+{
+public:
+    TextWriter(Sink sink, const std::vector<std::string>& names, const WriteOptions& options)
+        : mBuffer{std::move(sink), options.buffer_size}
+        , mFormat{options.format}
+        , mNull{options.null_value}
+        , mQuoted{options.format == TextFormat::tsv ? "\t\n\r\\" : ",\"\n\r"}
+    {
+        if (options.buffer_size < MIN_TEXT_BUFFER)
+            throw std::invalid_argument{
+                std::format("Write buffer_size must be at least {} bytes.", MIN_TEXT_BUFFER)};
+
+        if (mFormat == TextFormat::jsonl)
+        {
+            // Prepare the object keys so that each row only copies them.
+            TextBuffer key{[this](const char* data, std::size_t size)
+                           { mKeys.back().append(data, size); },
+                           MIN_TEXT_BUFFER};
+            for (auto& name : names)
+            {
+                mKeys.emplace_back(mKeys.empty() ? "{" : ",");
+                write_json_string(key, name);
+                key.put(':');
+                key.flush();
+            }
+        }
+    }
+
+    void write_header(const std::vector<std::string>& names)
+    {
+        for (std::size_t col{0}; col < names.size(); ++col)
+        {
+            if (col > 0)
+                mBuffer.put(delimiter());
+            write_string(names[col]);
+        }
+        mBuffer.put('\n');
+    }
+
+    void write_row(std::span<const Column> columns, std::size_t row)
+    {
+        for (std::size_t col{0}; col < columns.size(); ++col)
+        {
+            if (mFormat == TextFormat::jsonl)
+                mBuffer.append(mKeys[col]);
+            else if (col > 0)
+                mBuffer.put(delimiter());
+
+            std::visit([&](const auto& column) { write_value(column, row); }, columns[col]);
+        }
+
+        if (mFormat == TextFormat::jsonl)
+            mBuffer.put('}');
+        mBuffer.put('\n');
+    }
+
+    void flush()
+    {
+        mBuffer.flush();
+    }
+
+private:
+    char delimiter() const
+    {
+        return mFormat == TextFormat::tsv ? '\t' : ',';
+    }
+
+    template <typename T> void write_value(const ColumnView<T>& column, std::size_t row)
+    {
+        if (column.is_null(row))
+        {
+            mBuffer.append(mFormat == TextFormat::jsonl ? std::string_view{"null"} : mNull);
+            return;
+        }
+
+        if constexpr (std::is_same_v<T, bool>)
+            mBuffer.append(column[row] ? "true" : "false");
+        else if constexpr (std::is_arithmetic_v<T>)
+            write_number(column[row]);
+        else if constexpr (std::is_same_v<T, duckdb::date_t>)
+            write_date(column[row]);
+        else if constexpr (std::is_same_v<T, duckdb::timestamp_t>)
+            write_timestamp(column.type().id(), column[row]);
+        else if constexpr (std::is_same_v<T, duckdb::hugeint_t> ||
+                           std::is_same_v<T, duckdb::uhugeint_t>)
+            mBuffer.append(duckdb::Value::CreateValue(column[row]).ToString());
+        else if constexpr (std::is_same_v<T, duckdb::string_t>)
+            write_string(column.type().id(), column[row]);
+        else if constexpr (std::is_same_v<T, duckdb::Value>)
+        {
+            auto value{column[row]};
+            if (mFormat == TextFormat::jsonl && value.type().IsNumeric())
+                mBuffer.append(value.ToString());
+            else
+                write_string(value.ToString());
+        }
+        else
+            write_string(duckdb::Value::CreateValue(column[row]).ToString());
+    }
+
+    template <typename T> void write_number(T value)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            // JSON has no representation for NaN and infinities.
+            if (mFormat == TextFormat::jsonl && !std::isfinite(value))
+            {
+                mBuffer.append("null");
+                return;
+            }
+        }
+
+        auto out{mBuffer.reserve()};
+        mBuffer.commit(std::to_chars(out, out + MAX_FIELD_SIZE, value).ptr);
+    }
+
+    void write_date(duckdb::date_t date)
+    {
+        auto out{mBuffer.reserve()};
+        out = quote(out);
+        out = details::write_date(out, date);
+        mBuffer.commit(quote(out));
+    }
+
+    // Timestamps are split in days and time of day, the formatted date is cached as
+    // consecutive values usually fall on the same day.
+    void write_timestamp(duckdb::LogicalTypeId typeId, duckdb::timestamp_t ts)
+    {
+        if (ts == duckdb::timestamp_t::infinity() || ts == duckdb::timestamp_t::ninfinity())
+        {
+            write_string(ts == duckdb::timestamp_t::infinity() ? "infinity" : "-infinity");
+            return;
+        }
+
+        int64_t unitsPerSecond{duckdb::Interval::MICROS_PER_SEC};
+        int fractionDigits{6};
+        switch (typeId)
+        {
+        case duckdb::LogicalTypeId::TIMESTAMP_SEC:
+            unitsPerSecond = 1;
+            fractionDigits = 0;
+            break;
+        case duckdb::LogicalTypeId::TIMESTAMP_MS:
+            unitsPerSecond = duckdb::Interval::MSECS_PER_SEC;
+            fractionDigits = 3;
+            break;
+        case duckdb::LogicalTypeId::TIMESTAMP_NS:
+            unitsPerSecond = duckdb::Interval::NANOS_PER_SEC;
+            fractionDigits = 9;
+            break;
+        default:
+            break;
+        }
+
+        const int64_t unitsPerDay{unitsPerSecond * duckdb::Interval::SECS_PER_DAY};
+        auto days{ts.value / unitsPerDay};
+        auto units{ts.value % unitsPerDay};
+        if (units < 0)
+        {
+            --days;
+            units += unitsPerDay;
+        }
+
+        if (days != mCachedDay)
+        {
+            auto date{duckdb::date_t{static_cast<int32_t>(days)}};
+            auto end{details::write_date(mCachedDate.data(), date)};
+            mCachedDateSize = end - mCachedDate.data();
+            mCachedDay = days;
+        }
+
+        auto seconds{units / unitsPerSecond};
+        auto fraction{units % unitsPerSecond};
+
+        auto out{mBuffer.reserve()};
+        out = quote(out);
+        out = std::copy_n(mCachedDate.data(), mCachedDateSize, out);
+        *out++ = ' ';
+        out = write_2digits(out, seconds / 3600);
+        *out++ = ':';
+        out = write_2digits(out, seconds / 60 % 60);
+        *out++ = ':';
+        out = write_2digits(out, seconds % 60);
+
+        if (fraction > 0)
+        {
+            // Fixed width fraction without trailing zeros.
+            while (fraction % 10 == 0)
+            {
+                fraction /= 10;
+                --fractionDigits;
+            }
+
+            *out++ = '.';
+            for (int digit{fractionDigits - 1}; digit >= 0; --digit)
+            {
+                out[digit] = static_cast<char>('0' + fraction % 10);
+                fraction /= 10;
+            }
+            out += fractionDigits;
+        }
+
+        if (typeId == duckdb::LogicalTypeId::TIMESTAMP_TZ)
+            out = std::copy_n("+00", 3, out);
+
+        mBuffer.commit(quote(out));
+    }
+
+    void write_string(duckdb::LogicalTypeId typeId, std::string_view str)
+    {
+        if (typeId == duckdb::LogicalTypeId::BLOB)
+        {
+            duckdb::string_t blob{str.data(), static_cast<uint32_t>(str.size())};
+            write_string(duckdb::Blob::ToString(blob));
+        }
+        else if (typeId == duckdb::LogicalTypeId::BIT)
+            write_string(BitView{std::as_bytes(std::span{str})}.to_string());
+        else
+            write_string(str);
+    }
+
+    void write_string(std::string_view str)
+    {
+        switch (mFormat)
+        {
+        case TextFormat::csv:
+            write_csv_string(str);
+            break;
+        case TextFormat::tsv:
+            write_tsv_string(str);
+            break;
+        case TextFormat::jsonl:
+            write_json_string(mBuffer, str);
+            break;
+        }
+    }
+
+    // Strings with delimiters, quotes or line breaks are quoted and so are strings that
+    // would be read back as NULL.
+    void write_csv_string(std::string_view str)
+    {
+        if (str.find_first_of(mQuoted) == std::string_view::npos && str != mNull)
+        {
+            mBuffer.append(str);
+            return;
+        }
+
+        mBuffer.put('"');
+        for (auto pos{str.find('"')}; pos != std::string_view::npos; pos = str.find('"'))
+        {
+            mBuffer.append(str.substr(0, pos + 1));
+            mBuffer.put('"');
+            str.remove_prefix(pos + 1);
+        }
+        mBuffer.append(str);
+        mBuffer.put('"');
+    }
+
+    // Tabs, line breaks and backslashes are escaped with a backslash.
+    void write_tsv_string(std::string_view str)
+    {
+        for (auto pos{str.find_first_of(mQuoted)}; pos != std::string_view::npos;
+             pos = str.find_first_of(mQuoted))
+        {
+            mBuffer.append(str.substr(0, pos));
+            mBuffer.put('\\');
+            switch (str[pos])
+            {
+            case '\t':
+                mBuffer.put('t');
+                break;
+            case '\n':
+                mBuffer.put('n');
+                break;
+            case '\r':
+                mBuffer.put('r');
+                break;
+            default:
+                mBuffer.put(str[pos]);
+            }
+            str.remove_prefix(pos + 1);
+        }
+        mBuffer.append(str);
+    }
+
+    template <typename Buffer> static void write_json_string(Buffer& buffer, std::string_view str)
+    {
+        buffer.put('"');
+
+        std::size_t begin{0};
+        for (std::size_t pos{0}; pos < str.size(); ++pos)
+        {
+            auto c{static_cast<unsigned char>(str[pos])};
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+
+            buffer.append(str.substr(begin, pos - begin));
+            begin = pos + 1;
+
+            buffer.put('\\');
+            switch (c)
+            {
+            case '"':
+            case '\\':
+                buffer.put(static_cast<char>(c));
+                break;
+            case '\n':
+                buffer.put('n');
+                break;
+            case '\r':
+                buffer.put('r');
+                break;
+            case '\t':
+                buffer.put('t');
+                break;
+            default:
+                buffer.append("u00");
+                buffer.put("0123456789abcdef"[c >> 4]);
+                buffer.put("0123456789abcdef"[c & 0xf]);
+            }
+        }
+        buffer.append(str.substr(begin));
+
+        buffer.put('"');
+    }
+
+    char* quote(char* out) const
+    {
+        if (mFormat == TextFormat::jsonl)
+            *out++ = '"';
+        return out;
+    }
+
+    TextBuffer<Sink> mBuffer;
+    TextFormat mFormat;
+    std::string_view mNull;
+    std::string_view mQuoted;
+    std::vector<std::string> mKeys;
+    int64_t mCachedDay{std::numeric_limits<int64_t>::min()};
+    std::array<char, MAX_FIELD_SIZE> mCachedDate{};
+    std::size_t mCachedDateSize{0};
+};
+
+struct StreamSink
+{
+    std::ostream& os;
+
+    void operator()(const char* data, std::size_t size)
+    {
+        os.write(data, static_cast<std::streamsize>(size));
+        if (!os)
+            throw std::runtime_error{"Failed to write to output stream."};
+    }
+};
+
+#ifdef DUCKFOREACH_HAS_UNISTD
+struct FileSink
+{
+    int fd;
+
+    void operator()(const char* data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            auto written{::write(fd, data, size)};
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error{errno, std::generic_category(),
+                                        "Failed to write to file descriptor"};
+            }
+
+            data += written;
+            size -= written;
+        }
+    }
+};
+#endif
+
+template <typename Sink>
+std::size_t write_text(duckdb::QueryResult& result, Sink sink, const WriteOptions& options)
+{
+    TextWriter<Sink> writer{std::move(sink), result.names, options};
+    if (options.header && options.format != TextFormat::jsonl)
+        writer.write_header(result.names);
+
+    std::vector<Column> columns;
+    std::size_t firstRow{0};
+    while (auto chunk{result.Fetch()})
+    {
+        chunk->Flatten();
+
+        columns.clear();
+        for (std::size_t col{0}; col < chunk->ColumnCount(); ++col)
+            columns.push_back(
+                make_column(col, result.names[col], chunk->data[col], chunk->size(), firstRow));
+
+        for (std::size_t row{0}; row < chunk->size(); ++row)
+            writer.write_row(columns, row);
+
+        firstRow += chunk->size();
+    }
+
+    check_stream_error(result);
+    writer.flush();
+
+    return firstRow;
+}
+
+} // namespace details
+
+// Writes the result to os as CSV, TSV or JSON lines and returns the number of rows written.
+//
+// Values are formatted directly from the chunk data into a buffer of options.buffer_size
+// bytes that is written to os when full, numbers use std::to_chars and dates and timestamps
+// use ISO 8601 like DuckDB.
+inline std::size_t write_csv(std::unique_ptr<duckdb::QueryResult> result,
+                             std::ostream& os,
+                             const WriteOptions& options = {})
+{
+    details::check_result(result);
+    return details::write_text(*result, details::StreamSink{os}, options);
+}
+
+#ifdef DUCKFOREACH_HAS_UNISTD
+// Same as above writing to a file descriptor with write(2), fd is not closed.
+inline std::size_t
+write_csv(std::unique_ptr<duckdb::QueryResult> result, int fd, const WriteOptions& options = {})
+{
+    details::check_result(result);
+    return details::write_text(*result, details::FileSink{fd}, options);
+}
+#endif
+
+namespace details {
+
+// The frame format used by serialize and for_each_frame, integers use the native byte
+// order as it is meant for processes running on the same machine.
+//
+// Each frame is a uint32_t payload size followed by the payload, the first frame holds
+// the schema and a frame with an empty payload ends the stream:
+//
+//   schema: "DFE1" uint32_t columns, per column: uint8_t type id, uint8_t width,
+//           uint8_t scale, uint32_t name size, name
+//   chunk:  uint32_t rows, per column: uint8_t has nulls, an optional validity bitmap of
+//           (rows + 7) / 8 bytes with bit i set for valid row i, then the values as
+//           rows * type size bytes or for strings as uint32_t offsets[rows + 1] and the
+//           concatenated bytes.
+inline constexpr std::string_view FRAME_MAGIC{"DFE1"};
+
+inline bool is_frame_string(const duckdb::LogicalType& type)
+{
+    using duckdb::LogicalTypeId;
+
+    switch (type.id())
+    {
+    case LogicalTypeId::VARCHAR:
+    case LogicalTypeId::BLOB:
+    case LogicalTypeId::BIT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline bool is_frame_type(const duckdb::LogicalType& type)
+{
+    using duckdb::LogicalTypeId;
+
+    switch (type.id())
+    {
+    case LogicalTypeId::BOOLEAN:
+    case LogicalTypeId::TINYINT:
+    case LogicalTypeId::SMALLINT:
+    case LogicalTypeId::INTEGER:
+    case LogicalTypeId::BIGINT:
+    case LogicalTypeId::UTINYINT:
+    case LogicalTypeId::USMALLINT:
+    case LogicalTypeId::UINTEGER:
+    case LogicalTypeId::UBIGINT:
+    case LogicalTypeId::HUGEINT:
+    case LogicalTypeId::UHUGEINT:
+    case LogicalTypeId::FLOAT:
+    case LogicalTypeId::DOUBLE:
+    case LogicalTypeId::DECIMAL:
+    case LogicalTypeId::DATE:
+    case LogicalTypeId::TIME:
+    case LogicalTypeId::TIMESTAMP:
+    case LogicalTypeId::TIMESTAMP_SEC:
+    case LogicalTypeId::TIMESTAMP_MS:
+    case LogicalTypeId::TIMESTAMP_NS:
+    case LogicalTypeId::TIMESTAMP_TZ:
+    case LogicalTypeId::INTERVAL:
+    case LogicalTypeId::UUID:
+        return true;
+    default:
+        return is_frame_string(type);
+    }
+}
+
+inline std::runtime_error invalid_frame_error()
+{
+    return std::runtime_error{"Invalid frame data."};
+}
+
+// Builds a frame in a buffer that is reused across frames.
+class FrameWriter
+{
+public:
+    void begin()
+    {
+        mData.resize(sizeof(uint32_t));
+    }
+
+    template <typename T> void put(T value)
+    {
+        put(&value, sizeof(T));
+    }
+
+    void put(const void* data, std::size_t size)
+    {
+        auto bytes{static_cast<const char*>(data)};
+        mData.insert(mData.end(), bytes, bytes + size);
+    }
+
+    // Stores the payload size in front of the frame and writes it to the sink.
+    template <typename Sink> void end(Sink& sink)
+    {
+        auto size{mData.size() - sizeof(uint32_t)};
+        if (size > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error{"Frame size exceeds 4GB."};
+
+        auto size32{static_cast<uint32_t>(size)};
+        std::memcpy(mData.data(), &size32, sizeof(size32));
+        sink(mData.data(), mData.size());
+    }
+
+private:
+    std::vector<char> mData;
+};
+
+inline void write_schema_frame(FrameWriter& writer, duckdb::QueryResult& result)
+{
+    writer.begin();
+    writer.put(FRAME_MAGIC.data(), FRAME_MAGIC.size());
+    writer.put(static_cast<uint32_t>(result.ColumnCount()));
+
+    for (std::size_t col{0}; col < result.ColumnCount(); ++col)
+    {
+        auto& type{result.types[col]};
+        if (!is_frame_type(type))
+            throw std::invalid_argument{std::format(
+                "Column {} type {} is not supported by serialize", col + 1, type.ToString())};
+
+        uint8_t width{0}, scale{0};
+        if (type.id() == duckdb::LogicalTypeId::DECIMAL)
+            type.GetDecimalProperties(width, scale);
+
+        auto& name{result.names[col]};
+        writer.put(static_cast<uint8_t>(type.id()));
+        writer.put(width);
+        writer.put(scale);
+        writer.put(static_cast<uint32_t>(name.size()));
+        writer.put(name.data(), name.size());
+    }
+}
+
+inline void write_chunk_frame(FrameWriter& writer, duckdb::DataChunk& chunk)
+{
+    const auto rows{chunk.size()};
+
+    writer.begin();
+    writer.put(static_cast<uint32_t>(rows));
+
+    std::vector<uint8_t> bitmap;
+    std::vector<uint32_t> offsets;
+    for (auto& vec : chunk.data)
+    {
+        auto& validity{duckdb::FlatVector::Validity(vec)};
+        const bool hasNulls{!validity.CheckAllValid(rows)};
+        writer.put(static_cast<uint8_t>(hasNulls));
+
+        if (hasNulls)
+        {
+            bitmap.assign((rows + 7) / 8, 0);
+            for (duckdb::idx_t row{0}; row < rows; ++row)
+            {
+                if (validity.RowIsValid(row))
+                    bitmap[row / 8] |= static_cast<uint8_t>(1 << (row % 8));
+            }
+            writer.put(bitmap.data(), bitmap.size());
+        }
+
+        if (is_frame_string(vec.GetType()))
+        {
+            auto strs{duckdb::FlatVector::GetData<duckdb::string_t>(vec)};
+
+            offsets.assign(1, 0);
+            for (duckdb::idx_t row{0}; row < rows; ++row)
+            {
+                auto size{validity.RowIsValid(row) ? strs[row].GetSize() : 0};
+                offsets.push_back(offsets.back() + static_cast<uint32_t>(size));
+            }
+            writer.put(offsets.data(), offsets.size() * sizeof(uint32_t));
+
+            for (duckdb::idx_t row{0}; row < rows; ++row)
+            {
+                if (validity.RowIsValid(row))
+                    writer.put(strs[row].GetData(), strs[row].GetSize());
+            }
+        }
+        else
+        {
+            auto size{duckdb::GetTypeIdSize(vec.GetType().InternalType())};
+            writer.put(duckdb::FlatVector::GetData(vec), rows * size);
+        }
+    }
+}
+
+template <typename Sink> std::size_t serialize_impl(duckdb::QueryResult& result, Sink sink)
+{
+    FrameWriter writer;
+    write_schema_frame(writer, result);
+    writer.end(sink);
+
+    std::size_t numRows{0};
+    while (auto chunk{result.Fetch()})
+    {
+        chunk->Flatten();
+        write_chunk_frame(writer, *chunk);
+        writer.end(sink);
+        numRows += chunk->size();
+    }
+
+    check_stream_error(result);
+
+    writer.begin();
+    writer.end(sink);
+
+    return numRows;
+}
+
+struct StreamReader
+{
+    std::istream& is;
+
+    std::size_t operator()(char* data, std::size_t size)
+    {
+        is.read(data, static_cast<std::streamsize>(size));
+        if (is.bad())
+            throw std::runtime_error{"Failed to read from input stream."};
+        return static_cast<std::size_t>(is.gcount());
+    }
+};
+
+#ifdef DUCKFOREACH_HAS_UNISTD
+struct FileReader
+{
+    int fd;
+
+    std::size_t operator()(char* data, std::size_t size)
+    {
+        std::size_t total{0};
+        while (total < size)
+        {
+            auto count{::read(fd, data + total, size - total)};
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error{errno, std::generic_category(),
+                                        "Failed to read from file descriptor"};
+            }
+
+            if (count == 0)
+                break;
+            total += count;
+        }
+        return total;
+    }
+};
+#endif
+
+// Bounds checked reads from a frame payload.
+class FrameCursor
+{
+public:
+    explicit FrameCursor(std::span<const char> data)
+        : mData{data}
+    {
+    }
+
+    template <typename T> T get()
+    {
+        T value;
+        std::memcpy(&value, bytes(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+
+    std::span<const char> bytes(std::size_t size)
+    {
+        if (size > mData.size())
+            throw invalid_frame_error();
+
+        auto data{mData.first(size)};
+        mData = mData.subspan(size);
+        return data;
+    }
+
+private:
+    std::span<const char> mData;
+};
+
+// Reads frames with a byte reader into a buffer, the frame data is valid until the next
+// call.
+template <typename Reader> class BufferedFrames
+{
+public:
+    explicit BufferedFrames(Reader reader)
+        : mReader{std::move(reader)}
+    {
+    }
+
+    // Returns the frame payload, empty at the end of the stream.
+    std::span<const char> next()
+    {
+        uint32_t size{0};
+        if (mReader(reinterpret_cast<char*>(&size), sizeof(size)) != sizeof(size))
+            throw std::runtime_error{"Unexpected end of frame stream."};
+
+        mFrame.resize(size);
+        if (mReader(mFrame.data(), size) != size)
+            throw std::runtime_error{"Unexpected end of frame stream."};
+
+        return mFrame;
+    }
+
+private:
+    Reader mReader;
+    std::vector<char> mFrame;
+};
+
+// Decodes frames into a chunk, string values reference the frame data.
+template <typename Frames> class FrameSource
+{
+public:
+    explicit FrameSource(Frames& frames)
+        : mFrames{frames}
+    {
+        auto frame{mFrames.next()};
+        if (frame.empty())
+            throw invalid_frame_error();
+
+        FrameCursor cursor{frame};
+        auto magic{cursor.bytes(FRAME_MAGIC.size())};
+        if (std::string_view{magic.data(), magic.size()} != FRAME_MAGIC)
+            throw invalid_frame_error();
+
+        auto ncols{cursor.get<uint32_t>()};
+        for (uint32_t col{0}; col < ncols; ++col)
+        {
+            auto typeId{static_cast<duckdb::LogicalTypeId>(cursor.get<uint8_t>())};
+            auto width{cursor.get<uint8_t>()};
+            auto scale{cursor.get<uint8_t>()};
+            auto name{cursor.bytes(cursor.get<uint32_t>())};
+
+            auto type{typeId == duckdb::LogicalTypeId::DECIMAL
+                          ? duckdb::LogicalType::DECIMAL(width, scale)
+                          : duckdb::LogicalType{typeId}};
+            if (!is_frame_type(type))
+                throw invalid_frame_error();
+
+            mTypes.push_back(type);
+            mNames.emplace_back(name.data(), name.size());
+        }
+
+        mChunk.Initialize(duckdb::Allocator::DefaultAllocator(), mTypes);
+    }
+
+    std::size_t column_count() const
+    {
+        return mTypes.size();
+    }
+
+    duckdb::DataChunk* next()
+    {
+        auto frame{mFrames.next()};
+        if (frame.empty())
+            return nullptr;
+
+        mChunk.Reset();
+
+        FrameCursor cursor{frame};
+        auto rows{cursor.get<uint32_t>()};
+        if (rows > STANDARD_VECTOR_SIZE)
+            throw invalid_frame_error();
+
+        for (auto& vec : mChunk.data)
+            read_column(cursor, vec, rows);
+
+        mChunk.SetCardinality(rows);
+        return &mChunk;
+    }
+
+private:
+    void read_column(FrameCursor& cursor, duckdb::Vector& vec, uint32_t rows)
+    {
+        if (cursor.get<uint8_t>())
+        {
+            auto bitmap{cursor.bytes((rows + 7) / 8)};
+            auto& validity{duckdb::FlatVector::Validity(vec)};
+            for (uint32_t row{0}; row < rows; ++row)
+            {
+                if (!(static_cast<uint8_t>(bitmap[row / 8]) & (1 << (row % 8))))
+                    validity.SetInvalid(row);
+            }
+        }
+
+        if (is_frame_string(vec.GetType()))
+        {
+            auto offsets{cursor.bytes((rows + 1) * sizeof(uint32_t))};
+            auto offset = [&](uint32_t row)
+            {
+                uint32_t value;
+                std::memcpy(&value, offsets.data() + row * sizeof(uint32_t), sizeof(value));
+                return value;
+            };
+
+            auto data{cursor.bytes(offset(rows))};
+            auto strs{duckdb::FlatVector::GetData<duckdb::string_t>(vec)};
+            for (uint32_t row{0}; row < rows; ++row)
+            {
+                auto begin{offset(row)}, end{offset(row + 1)};
+                if (begin > end || end > data.size())
+                    throw invalid_frame_error();
+                strs[row] = duckdb::string_t{data.data() + begin, end - begin};
+            }
+        }
+        else
+        {
+            auto size{duckdb::GetTypeIdSize(vec.GetType().InternalType())};
+            std::memcpy(duckdb::FlatVector::GetData(vec), cursor.bytes(rows * size).data(),
+                        rows * size);
+        }
+    }
+
+    Frames& mFrames;
+    duckdb::vector<duckdb::LogicalType> mTypes;
+    std::vector<std::string> mNames;
+    duckdb::DataChunk mChunk;
+};
+
+// Frames stored in memory, the frames reference the memory data.
+class MemoryFrames
+{
+public:
+    explicit MemoryFrames(std::span<const char> data)
+        : mData{data}
+    {
+    }
+
+    // Returns the frame payload, empty at the end of the stream.
+    std::span<const char> next()
+    {
+        uint32_t size{0};
+        if (mData.size() < sizeof(size))
+            throw std::runtime_error{"Unexpected end of frame stream."};
+
+        std::memcpy(&size, mData.data(), sizeof(size));
+        if (mData.size() - sizeof(size) < size)
+            throw std::runtime_error{"Unexpected end of frame stream."};
+
+        auto frame{mData.subspan(sizeof(size), size)};
+        mData = mData.subspan(sizeof(size) + size);
+        return frame;
+    }
+
+    // True if the remaining data is a sequence of frames ending with an empty frame.
+    bool complete() const
+    {
+        MemoryFrames frames{mData};
+        try
+        {
+            while (!frames.next().empty())
+                ;
+        }
+        catch (const std::runtime_error&)
+        {
+            return false;
+        }
+        return frames.mData.empty();
+    }
+
+private:
+    std::span<const char> mData;
+};
+
+// Chunks stored in memory, several sources can read the same chunks at once because
+// converting the rows of a flat chunk doesn't modify it.
+class ChunkSource
+{
+public:
+    ChunkSource(std::span<const std::unique_ptr<duckdb::DataChunk>> chunks,
+                std::size_t numColumns)
+        : mChunks{chunks}
+        , mNumColumns{numColumns}
+    {
+    }
+
+    std::size_t column_count() const
+    {
+        return mNumColumns;
+    }
+
+    duckdb::DataChunk* next()
+    {
+        if (mNext == mChunks.size())
+            return nullptr;
+        return mChunks[mNext++].get();
+    }
+
+private:
+    std::span<const std::unique_ptr<duckdb::DataChunk>> mChunks;
+    std::size_t mNumColumns;
+    std::size_t mNext{0};
+};
+
+template <typename F, typename Source, typename R, typename... Args>
+auto for_each_frame_impl(Source& source, std::function<R(Args...)>&& f)
+{
+    if constexpr (details::is_valid_signature<Args...>())
+    {
+        check_columns<Args...>(source.column_count());
+
+        RowConverter<Args...> converter;
+        std::size_t firstRow{0};
+        while (auto chunk{source.next()})
+        {
+            converter.for_each_row(*chunk, firstRow, f);
+            firstRow += chunk->size();
+        }
+    }
+
+    return *f.template target<F>();
+}
+
+} // namespace details
+
+// Writes the result to os in a length-prefixed columnar frame format, one frame per chunk,
+// that can be read back with for_each_frame. Returns the number of rows written.
+//
+// Values are copied from the chunk vectors as they are so the format is meant for
+// processes on the same machine using the same library version, nested and other types
+// without a flat representation are not supported.
+inline std::size_t serialize(std::unique_ptr<duckdb::QueryResult> result, std::ostream& os)
+{
+    details::check_result(result);
+    return details::serialize_impl(*result, details::StreamSink{os});
+}
+
+// Reads the frames written by serialize and calls f with each row, f takes the same
+// argument types as for_each.
+template <typename F> auto for_each_frame(std::istream& is, F f)
+{
+    details::BufferedFrames frames{details::StreamReader{is}};
+    details::FrameSource source{frames};
+    return details::for_each_frame_impl<F>(source, std::function{f});
+}
+
+#ifdef DUCKFOREACH_HAS_UNISTD
+// Same as above using a file descriptor, like a pipe or a socket.
+inline std::size_t serialize(std::unique_ptr<duckdb::QueryResult> result, int fd)
+{
+    details::check_result(result);
+    return details::serialize_impl(*result, details::FileSink{fd});
+}
+
+template <typename F> auto for_each_frame(int fd, F f)
+{
+    details::BufferedFrames frames{details::FileReader{fd}};
+    details::FrameSource source{frames};
+    return details::for_each_frame_impl<F>(source, std::function{f});
+}
+#endif
+
+#ifdef DUCKFOREACH_HAS_MMAP
+// Options for cached_for_each.
+struct CacheOptions
+{
+    // Values for the query ? placeholders, they are part of the cache key.
+    std::vector<duckdb::Value> parameters{};
+    // Entries written with a different version are refreshed.
+    std::string version{};
+    // Entries older than ttl are refreshed, zero for entries that never expire.
+    std::chrono::seconds ttl{0};
+};
+
+namespace details {
+
+// Cache files start with a frame with "DFC1", uint32_t key size, key, uint32_t version size
+// and version followed by the frames written by serialize.
+inline constexpr std::string_view CACHE_MAGIC{"DFC1"};
+
+// FNV-1a, the file names must not change across runs.
+inline uint64_t fnv1a_hash(std::string_view data)
+{
+    uint64_t hash{14695981039346656037ull};
+    for (auto c : data)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// A read-only memory mapping of a file, empty if the file cannot be mapped.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::filesystem::path& path)
+    {
+        auto fd{::open(path.c_str(), O_RDONLY)};
+        if (fd < 0)
+            return;
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            auto size{static_cast<std::size_t>(st.st_size)};
+            auto addr{::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+            if (addr != MAP_FAILED)
+                mData = {static_cast<const char*>(addr), size};
+        }
+
+        ::close(fd);
+    }
+
+    MappedFile(MappedFile&& rhs) noexcept
+        : mData{std::exchange(rhs.mData, {})}
+    {
+    }
+
+    MappedFile& operator=(MappedFile&& rhs) noexcept
+    {
+        std::swap(mData, rhs.mData);
+        return *this;
+    }
+
+    ~MappedFile()
+    {
+        if (!mData.empty())
+            ::munmap(const_cast<char*>(mData.data()), mData.size());
+    }
+
+    std::span<const char> data() const
+    {
+        return mData;
+    }
+
+private:
+    std::span<const char> mData;
+};
+
+inline std::string cache_key(const std::string& sql, const CacheOptions& options)
+{
+    std::string key{sql};
+    for (auto& param : options.parameters)
+    {
+        key += '\0';
+        key += param.ToSQLString();
+    }
+    return key;
+}
+
+inline bool is_expired(const std::filesystem::path& path, std::chrono::seconds ttl)
+{
+    if (ttl.count() == 0)
+        return false;
+
+    std::error_code ec;
+    auto mtime{std::filesystem::last_write_time(path, ec)};
+    return ec || std::filesystem::file_time_type::clock::now() - mtime > ttl;
+}
+
+// Reads the cache header frame, returns false if the file is not a complete cache entry
+// for the key and version.
+inline bool
+read_cache_header(MemoryFrames& frames, std::string_view key, std::string_view version)
+{
+    try
+    {
+        FrameCursor cursor{frames.next()};
+        auto magic{cursor.bytes(CACHE_MAGIC.size())};
+        auto fileKey{cursor.bytes(cursor.get<uint32_t>())};
+        auto fileVersion{cursor.bytes(cursor.get<uint32_t>())};
+
+        return std::string_view{magic.data(), magic.size()} == CACHE_MAGIC &&
+               std::string_view{fileKey.data(), fileKey.size()} == key &&
+               std::string_view{fileVersion.data(), fileVersion.size()} == version &&
+               frames.complete();
+    }
+    catch (const std::runtime_error&)
+    {
+        return false;
+    }
+}
+
+// Runs the query and writes its frames to a temporary file that then replaces path, so
+// that readers never see a partial entry.
+inline void write_cache_file(duckdb::Connection& con,
+                             const std::string& sql,
+                             const std::string& key,
+                             const CacheOptions& options,
+                             const std::filesystem::path& path)
+{
+    auto stmt{con.Prepare(sql)};
+    if (stmt->HasError())
+        throw std::runtime_error(std::format("Query error {}", stmt->GetError()));
+
+    duckdb::vector<duckdb::Value> params(options.parameters.begin(), options.parameters.end());
+    auto result{stmt->Execute(params, true)};
+    check_result(result);
+
+    std::filesystem::create_directories(path.parent_path());
+
+    auto tmpPath{path};
+    tmpPath += std::format(".{}.{}.tmp", ::getpid(),
+                           std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+    auto fd{::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)};
+    if (fd < 0)
+        throw std::system_error{errno, std::generic_category(),
+                                std::format("Failed to create {}", tmpPath.string())};
+
+    try
+    {
+        FileSink sink{fd};
+
+        FrameWriter writer;
+        writer.begin();
+        writer.put(CACHE_MAGIC.data(), CACHE_MAGIC.size());
+        writer.put(static_cast<uint32_t>(key.size()));
+        writer.put(key.data(), key.size());
+        writer.put(static_cast<uint32_t>(options.version.size()));
+        writer.put(options.version.data(), options.version.size());
+        writer.end(sink);
+
+        serialize_impl(*result, sink);
+
+        if (::close(std::exchange(fd, -1)) != 0)
+            throw std::system_error{errno, std::generic_category(),
+                                    std::format("Failed to write {}", tmpPath.string())};
+
+        std::filesystem::rename(tmpPath, path);
+    }
+    catch (...)
+    {
+        if (fd >= 0)
+            ::close(fd);
+
+        std::error_code ec;
+        std::filesystem::remove(tmpPath, ec);
+        throw;
+    }
+}
+
+} // namespace details
+
+// Calls f with each row of the query result like for_each, the result is cached in
+// cacheDir as a file of columnar frames keyed by the query text and parameters.
+//
+// Later calls with the same key iterate the memory mapped file without running the
+// query, string values are read in place and fixed width columns are copied into a
+// chunk. Entries are refreshed when options.version changes or when they are older than
+// options.ttl.
+template <typename F>
+auto cached_for_each(duckdb::Connection& con,
+                     const std::string& sql,
+                     F f,
+                     const std::filesystem::path& cacheDir,
+                     const CacheOptions& options = {})
+{
+    auto key{details::cache_key(sql, options)};
+    auto path{cacheDir / std::format("{:016x}.dfe", details::fnv1a_hash(key))};
+
+    details::MappedFile file;
+    if (!details::is_expired(path, options.ttl))
+        file = details::MappedFile{path};
+
+    details::MemoryFrames frames{file.data()};
+    if (!details::read_cache_header(frames, key, options.version))
+    {
+        details::write_cache_file(con, sql, key, options, path);
+
+        file = details::MappedFile{path};
+        frames = details::MemoryFrames{file.data()};
+        if (!details::read_cache_header(frames, key, options.version))
+            throw std::runtime_error{std::format("Invalid cache file {}", path.string())};
+    }
+
+    details::FrameSource source{frames};
+    return details::for_each_frame_impl<F>(source, std::function{f});
+}
+#endif
+
+// A thread-safe LRU cache of query results bounded by size in bytes.
+//
+// Results are stored as the flat chunks fetched from the query, so a hit converts the
+// column values to the argument types without decoding or copying the chunks, and readers
+// share them as immutable snapshots. A lookup loads the current index with an atomic
+// shared_ptr and doesn't take the cache mutex that is held only to insert or evict entries,
+// the atomic is not lock-free though, libstdc++ guards it with a short spin lock. Entries
+// evicted while a reader iterates them stay alive until the reader is done.
+class ResultCache
+{
+public:
+    explicit ResultCache(std::size_t maxBytes)
+        : mMaxBytes{maxBytes}
+        , mIndex{std::make_shared<const Index>()}
+    {
+    }
+
+    // Calls f with each row of the cached result for sql like for_each, on a miss the query
+    // runs on con, that should be used only by the calling thread, and the result is added
+    // to the cache if it fits.
+    template <typename F> F for_each(duckdb::Connection& con, const std::string& sql, F f)
+    {
+        auto entry{find(sql)};
+        if (!entry)
+            entry = insert(sql, load(con, sql));
+
+        details::ChunkSource source{entry->chunks, entry->numColumns};
+        return details::for_each_frame_impl<F>(source, std::function{f});
+    }
+
+    void erase(const std::string& sql)
+    {
+        std::lock_guard lock{mMutex};
+
+        auto index{std::make_shared<Index>(*mIndex.load())};
+        if (auto it{index->find(sql)}; it != index->end())
+        {
+            mBytes -= entry_bytes(*it);
+            index->erase(it);
+            mIndex.store(std::move(index));
+        }
+    }
+
+    void clear()
+    {
+        std::lock_guard lock{mMutex};
+        mIndex.store(std::make_shared<const Index>());
+        mBytes = 0;
+    }
+
+    // Number of cached results.
+    std::size_t size() const
+    {
+        return mIndex.load()->size();
+    }
+
+    // Size of the cached results.
+    std::size_t bytes() const
+    {
+        return mBytes;
+    }
+
+private:
+    struct Entry
+    {
+        std::size_t numColumns{0};
+        std::vector<std::unique_ptr<duckdb::DataChunk>> chunks;
+        std::size_t bytes{0};
+        mutable std::atomic<uint64_t> lastUsed{0};
+    };
+
+    using Index = std::unordered_map<std::string, std::shared_ptr<const Entry>>;
+
+    static std::size_t entry_bytes(const Index::value_type& item)
+    {
+        return item.first.size() + item.second->bytes;
+    }
+
+    static std::shared_ptr<Entry> load(duckdb::Connection& con, const std::string& sql)
+    {
+        auto result{con.SendQuery(sql)};
+        details::check_result(result);
+
+        auto entry{std::make_shared<Entry>()};
+        entry->numColumns = result->ColumnCount();
+        while (auto chunk{result->Fetch()})
+        {
+            chunk->Flatten();
+            entry->bytes += details::chunk_bytes(*chunk);
+            entry->chunks.push_back(std::move(chunk));
+        }
+        details::check_stream_error(*result);
+
+        return entry;
+    }
+
+    std::shared_ptr<const Entry> find(const std::string& sql) const
+    {
+        auto index{mIndex.load()};
+        auto it{index->find(sql)};
+        if (it == index->end())
+            return nullptr;
+
+        it->second->lastUsed.store(++mClock, std::memory_order_relaxed);
+        return it->second;
+    }
+
+    // Adds an entry evicting the least recently used ones, returns the cached entry if
+    // another thread has added the same query in the meantime.
+    std::shared_ptr<const Entry> insert(const std::string& sql, std::shared_ptr<Entry> entry)
+    {
+        entry->lastUsed = ++mClock;
+        if (sql.size() + entry->bytes > mMaxBytes)
+            return entry;
+
+        std::lock_guard lock{mMutex};
+
+        auto index{std::make_shared<Index>(*mIndex.load())};
+        auto [it, inserted]{index->try_emplace(sql, entry)};
+        if (!inserted)
+            return it->second;
+
+        mBytes += entry_bytes(*it);
+        while (mBytes > mMaxBytes)
+        {
+            auto lru{std::ranges::min_element(
+                *index, {}, [](auto& item) { return item.second->lastUsed.load(); })};
+            mBytes -= entry_bytes(*lru);
+            index->erase(lru);
+        }
+
+        mIndex.store(std::move(index));
+        return entry;
+    }
+
+    const std::size_t mMaxBytes;
+    std::atomic<std::shared_ptr<const Index>> mIndex;
+    mutable std::atomic<uint64_t> mClock{0};
+    std::atomic<std::size_t> mBytes{0};
+    std::mutex mMutex;
+};
+
+namespace details {
+
+template <typename T> struct optional_value
+{
+    using type = T;
+};
+
+template <typename T> struct optional_value<std::optional<T>>
+{
+    using type = T;
+};
+
+template <typename T> using optional_value_t = typename optional_value<T>::type;
+
+template <typename T>
+inline constexpr bool is_optional_v = !std::is_same_v<optional_value_t<T>, T>;
+
+template <typename T, typename U>
+inline constexpr bool is_comparable_v =
+    (std::three_way_comparable_with<optional_value_t<T>, optional_value_t<U>> ||
+     std::totally_ordered_with<optional_value_t<T>, optional_value_t<U>>) &&
+    !is_zero_copy_v<T> && !is_zero_copy_v<U>;
+
+// Three way comparison that orders NULL values last, like DuckDB does by default.
+template <typename T, typename U> std::weak_ordering compare_values(const T& lhs, const U& rhs)
+{
+    if constexpr (is_optional_v<T>)
+    {
+        if (!lhs)
+        {
+            if constexpr (is_optional_v<U>)
+                return rhs ? std::weak_ordering::greater : std::weak_ordering::equivalent;
+            else
+                return std::weak_ordering::greater;
+        }
+        return compare_values(*lhs, rhs);
+    }
+    else if constexpr (is_optional_v<U>)
+    {
+        return rhs ? compare_values(lhs, *rhs) : std::weak_ordering::less;
+    }
+    else if constexpr (std::is_integral_v<T> && std::is_integral_v<U> &&
+                       !std::is_same_v<T, bool> && !std::is_same_v<U, bool>)
+    {
+        // Compares the values and not their conversions, like BIGINT -1 and UBIGINT 0.
+        if (std::cmp_less(lhs, rhs))
+            return std::weak_ordering::less;
+        return std::cmp_greater(lhs, rhs) ? std::weak_ordering::greater
+                                          : std::weak_ordering::equivalent;
+    }
+    else if constexpr (std::three_way_comparable_with<T, U>)
+    {
+        auto cmp{lhs <=> rhs};
+        if (cmp < 0)
+            return std::weak_ordering::less;
+        return cmp > 0 ? std::weak_ordering::greater : std::weak_ordering::equivalent;
+    }
+    else
+    {
+        if (lhs < rhs)
+            return std::weak_ordering::less;
+        return rhs < lhs ? std::weak_ordering::greater : std::weak_ordering::equivalent;
+    }
+}
+
+// Calls f with the tuple element at a column index known only at run time.
+template <typename Tuple, typename F> void visit_at(std::size_t col, Tuple& row, F&& f)
+{
+    [&]<std::size_t... Is>(std::index_sequence<Is...>)
+    {
+        ((col == Is ? f(std::get<Is>(row)) : void()), ...);
+    }(std::make_index_sequence<std::tuple_size_v<std::remove_const_t<Tuple>>>{});
+}
+
+// Compares the lhs and rhs keys column by column.
+template <typename L, typename R>
+std::weak_ordering compare_keys(std::span<const std::size_t> lhsKeys,
+                                const L& lhs,
+                                std::span<const std::size_t> rhsKeys,
+                                const R& rhs)
+{
+    auto cmp{std::weak_ordering::equivalent};
+    for (std::size_t i{0}; i < lhsKeys.size() && cmp == 0; ++i)
+    {
+        visit_at(lhsKeys[i], lhs,
+                 [&](const auto& lval)
+                 {
+                     visit_at(rhsKeys[i], rhs,
+                              [&](const auto& rval)
+                              {
+                                  using T = std::decay_t<decltype(lval)>;
+                                  using U = std::decay_t<decltype(rval)>;
+                                  if constexpr (is_comparable_v<T, U>)
+                                      cmp = compare_values(lval, rval);
+                              });
+                 });
+    }
+
+    return cmp;
+}
+
+// Calls f with the std::type_identity of the tuple element at a run time column index.
+template <typename Tuple, typename F> void visit_type_at(std::size_t col, F&& f)
+{
+    [&]<std::size_t... Is>(std::index_sequence<Is...>)
+    {
+        ((col == Is ? f(std::type_identity<std::tuple_element_t<Is, Tuple>>{}) : void()), ...);
+    }(std::make_index_sequence<std::tuple_size_v<Tuple>>{});
+}
+
+// True if the values at the lhs and rhs columns can be compared.
+template <typename L, typename R> bool is_comparable_at(std::size_t lhsCol, std::size_t rhsCol)
+{
+    bool comparable{false};
+    visit_type_at<L>(lhsCol,
+                     [&]<typename T>(std::type_identity<T>)
+                     {
+                         visit_type_at<R>(rhsCol, [&]<typename U>(std::type_identity<U>)
+                                          { comparable = is_comparable_v<T, U>; });
+                     });
+    return comparable;
+}
+
+// Iterates the rows of an ordered result one at a time.
+template <typename... Args> class MergeCursor
+{
+public:
+    using Row = std::tuple<std::decay_t<Args>...>;
+
+    MergeCursor(duckdb::QueryResult& result, std::size_t index, std::vector<std::size_t> keyCols)
+        : mResult{result}
+        , mSource{result, 2}
+        , mIndex{index}
+        , mKeyCols{std::move(keyCols)}
+    {
+    }
+
+    void start()
+    {
+        mSource.start();
+    }
+
+    // Moves to the next row, returns false at the end of the result.
+    bool advance()
+    {
+        while (!mChunk || ++mRow >= mChunk->size())
+        {
+            if (mChunk)
+                mFirstRow += mChunk->size();
+
+            mChunk = mSource.next();
+            if (!mChunk)
+            {
+                check_stream_error(mResult);
+                return false;
+            }
+
+            mConverter.begin_chunk(*mChunk, mFirstRow);
+            mRow = 0;
+            if (mChunk->size() > 0)
+                break;
+        }
+
+        // The converter row and the current row are swapped, so both keep their string
+        // capacity across rows.
+        auto& row{mConverter.convert_row(*mChunk, mRow)};
+        if (mHasRow && compare_keys(mKeyCols, row, mKeyCols, mCurrent) < 0)
+            throw std::invalid_argument{
+                std::format("Result {} is not ordered by column {} at row {}", mIndex + 1,
+                            mKeyCols.front() + 1, mFirstRow + mRow + 1)};
+
+        std::swap(mCurrent, row);
+        mHasRow = true;
+        return true;
+    }
+
+    std::size_t index() const
+    {
+        return mIndex;
+    }
+
+    Row& current()
+    {
+        return mCurrent;
+    }
+
+    const Row& current() const
+    {
+        return mCurrent;
+    }
+
+private:
+    duckdb::QueryResult& mResult;
+    PrefetchSource mSource;
+    RowConverter<Args...> mConverter;
+    std::size_t mIndex;
+    std::vector<std::size_t> mKeyCols;
+    duckdb::DataChunk* mChunk{nullptr};
+    duckdb::idx_t mRow{0};
+    std::size_t mFirstRow{0};
+    Row mCurrent;
+    bool mHasRow{false};
+};
+
+template <typename F, typename R, typename... Args>
+auto merge_for_each_impl(std::size_t keyCol,
+                         std::span<std::unique_ptr<duckdb::QueryResult>> results,
+                         std::function<R(std::size_t, Args...)>&& f)
+{
+    if constexpr (details::is_valid_signature<Args...>())
+    {
+        using Cursor = MergeCursor<Args...>;
+        using Row = typename Cursor::Row;
+
+        if (!is_comparable_at<Row, Row>(keyCol, keyCol))
+            throw std::invalid_argument{
+                std::format("Invalid merge column {}, the argument type is not ordered",
+                            keyCol + 1)};
+
+        std::vector<std::unique_ptr<Cursor>> cursors;
+        for (auto& result : results)
+        {
+            check_result(result);
+            check_columns<Args...>(*result);
+            cursors.push_back(std::make_unique<Cursor>(*result, cursors.size(),
+                                                      std::vector{keyCol}));
+        }
+
+        // Fetch the first chunks of all the results concurrently.
+        for (auto& cursor : cursors)
+            cursor->start();
+
+        // Min heap on the key column, rows with equal keys are delivered in source order.
+        const std::array keys{keyCol};
+        auto greater = [&keys](const Cursor* lhs, const Cursor* rhs)
+        {
+            auto cmp{compare_keys(keys, lhs->current(), keys, rhs->current())};
+            return cmp != 0 ? cmp > 0 : lhs->index() > rhs->index();
+        };
+
+        std::vector<Cursor*> heap;
+        for (auto& cursor : cursors)
+        {
+            if (cursor->advance())
+                heap.push_back(cursor.get());
+        }
+        std::ranges::make_heap(heap, greater);
+
+        while (!heap.empty())
+        {
+            std::ranges::pop_heap(heap, greater);
+            auto cursor{heap.back()};
+
+            // The key is copied since the next row of the cursor is checked against it.
+            [&]<std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                auto& values{cursor->current()};
+                f(cursor->index(), forward_arg<Args>(std::get<Is>(values), Is == keyCol)...);
+            }(std::index_sequence_for<Args...>{});
+
+            if (cursor->advance())
+                std::ranges::push_heap(heap, greater);
+            else
+                heap.pop_back();
+        }
+    }
+
+    return *f.template target<F>();
+}
+
+} // namespace details
+
+// Merges results ordered by the keyCol column calling f(std::size_t source, Args...) with
+// each row in global key order, source is the index of the row result.
+//
+// Each result is fetched on its own thread so stream results from separate connections,
+// like con.SendQuery("... order by ts"), run concurrently. Rows are converted a chunk at a
+// time and merged with a heap so memory is bounded by a few chunks per result, rows with
+// equal keys are delivered in source order. Throws std::invalid_argument if a result is
+// not ordered.
+template <typename F>
+auto merge_for_each(std::size_t keyCol,
+                    std::vector<std::unique_ptr<duckdb::QueryResult>> results,
+                    F f)
+{
+    return details::merge_for_each_impl<F>(keyCol, results, std::function{f});
+}
+
+// Same as above for results in a braced list, like {con1.SendQuery(q1), con2.SendQuery(q2)}.
+template <std::size_t N, typename F>
+auto merge_for_each(std::size_t keyCol, std::unique_ptr<duckdb::QueryResult> (&&results)[N], F f)
+{
+    return details::merge_for_each_impl<F>(keyCol, results, std::function{f});
+}
+
+namespace details {
+
+template <typename Row> struct join_cursor;
+
+template <typename... Args> struct join_cursor<std::tuple<Args...>>
+{
+    using type = MergeCursor<Args...>;
+
+    static constexpr bool is_valid()
+    {
+        return is_valid_signature<Args...>();
+    }
+
+    static void check(duckdb::QueryResult& result)
+    {
+        check_columns<Args...>(result);
+    }
+};
+
+// True if a key value in row is NULL.
+template <typename Row> bool has_null_key(std::span<const std::size_t> keys, const Row& row)
+{
+    bool isNull{false};
+    for (auto key : keys)
+    {
+        visit_at(key, row,
+                 [&]<typename T>(const T& value)
+                 {
+                     if constexpr (is_optional_v<T>)
+                         isNull = isNull || !value;
+                 });
+    }
+
+    return isNull;
+}
+
+template <typename F, typename R, typename LeftRow, typename RightRow>
+auto merge_join_impl(duckdb::QueryResult& left,
+                     duckdb::QueryResult& right,
+                     std::span<const std::pair<std::size_t, std::size_t>> keyCols,
+                     std::function<R(LeftRow, RightRow)>&& f)
+{
+    using Left = join_cursor<std::decay_t<LeftRow>>;
+    using Right = join_cursor<std::decay_t<RightRow>>;
+
+    if constexpr (Left::is_valid() && Right::is_valid())
+    {
+        using Row = std::decay_t<RightRow>;
+        static_assert([]<typename... Args>(std::type_identity<std::tuple<Args...>>)
+                      { return (!is_zero_copy_v<Args> && ...); }(std::type_identity<Row>{}),
+                      "Right rows are buffered, use owning argument types");
+
+        if (keyCols.empty())
+            throw std::invalid_argument{"Invalid merge join, no key columns"};
+
+        std::vector<std::size_t> leftKeys, rightKeys;
+        for (auto [leftCol, rightCol] : keyCols)
+        {
+            if (!is_comparable_at<std::decay_t<LeftRow>, Row>(leftCol, rightCol))
+                throw std::invalid_argument{std::format(
+                    "Invalid join columns {} and {}, the argument types are not comparable",
+                    leftCol + 1, rightCol + 1)};
+
+            leftKeys.push_back(leftCol);
+            rightKeys.push_back(rightCol);
+        }
+
+        Left::check(left);
+        Right::check(right);
+
+        typename Left::type leftCursor{left, 0, leftKeys};
+        typename Right::type rightCursor{right, 1, rightKeys};
+        leftCursor.start();
+        rightCursor.start();
+
+        // Rows with NULL keys never match and are ordered last, so they end the join.
+        auto advance = [](auto& cursor, std::span<const std::size_t> keys)
+        { return cursor.advance() && !has_null_key(keys, cursor.current()); };
+
+        auto hasLeft{advance(leftCursor, leftKeys)};
+        auto hasRight{advance(rightCursor, rightKeys)};
+
+        // The right rows with the current key, reused across keys.
+        std::vector<Row> group;
+        while (hasLeft && hasRight)
+        {
+            auto cmp{
+                compare_keys(leftKeys, leftCursor.current(), rightKeys, rightCursor.current())};
+            if (cmp < 0)
+            {
+                hasLeft = advance(leftCursor, leftKeys);
+            }
+            else if (cmp > 0)
+            {
+                hasRight = advance(rightCursor, rightKeys);
+            }
+            else
+            {
+                group.clear();
+                do
+                {
+                    group.push_back(rightCursor.current());
+                    hasRight = advance(rightCursor, rightKeys);
+                } while (hasRight && compare_keys(rightKeys, rightCursor.current(), rightKeys,
+                                                  group.front()) == 0);
+
+                do
+                {
+                    for (auto& row : group)
+                        f(leftCursor.current(), row);
+                    hasLeft = advance(leftCursor, leftKeys);
+                } while (hasLeft && compare_keys(leftKeys, leftCursor.current(), rightKeys,
+                                                 group.front()) == 0);
+            }
+        }
+    }
+
+    return *f.template target<F>();
+}
+
+} // namespace details
+
+// Inner joins two results ordered by their key columns calling f(LeftRow, RightRow) with
+// each pair of matching rows, where the rows are std::tuple of the argument types, like
+// f(const std::tuple<int64_t, double>&, const std::tuple<int64_t, std::string>&).
+//
+// keyCols lists the (left column, right column) pairs to join on, compared in order. Both
+// results are fetched on their own threads and converted a chunk at a time so memory is
+// bounded by a few chunks per result plus the right rows that share the current key. Rows
+// with NULL keys never match, results must be ordered with NULLS LAST (the default).
+// Throws std::invalid_argument if a result is not ordered.
+template <typename F>
+auto merge_join(std::unique_ptr<duckdb::QueryResult> left,
+                std::unique_ptr<duckdb::QueryResult> right,
+                const std::vector<std::pair<std::size_t, std::size_t>>& keyCols,
+                F f)
+{
+    details::check_result(left);
+    details::check_result(right);
+    return details::merge_join_impl<F>(*left, *right, keyCols, std::function{f});
+}
+
+// A pool of connections to a database shared by concurrent callers.
+//
+// Connections are created on demand up to maxConnections and reused together with their
+// prepared statements, acquire blocks while all the connections are in use.
+class ConnectionPool
+{
+    struct Slot
+    {
+        explicit Slot(duckdb::DuckDB& db)
+            : con{db}
+        {
+        }
+
+        duckdb::Connection con;
+        std::unordered_map<std::string, std::unique_ptr<duckdb::PreparedStatement>> statements;
+    };
+
+public:
+    // A connection that returns to the pool when destroyed, it must not outlive the pool.
+    class Handle
+    {
+    public:
+        Handle(Handle&& rhs) noexcept
+            : mPool{rhs.mPool}
+            , mSlot{std::move(rhs.mSlot)}
+        {
+        }
+
+        Handle& operator=(Handle&& rhs) noexcept
+        {
+            std::swap(mPool, rhs.mPool);
+            std::swap(mSlot, rhs.mSlot);
+            return *this;
+        }
+
+        ~Handle()
+        {
+            if (mSlot)
+                mPool->release(std::move(mSlot));
+        }
+
+        duckdb::Connection& operator*() const
+        {
+            return mSlot->con;
+        }
+
+        duckdb::Connection* operator->() const
+        {
+            return &mSlot->con;
+        }
+
+        // Returns the statement for sql prepared on this connection, statements are kept
+        // with the connection for the pool lifetime.
+        duckdb::PreparedStatement& prepare(const std::string& sql)
+        {
+            auto& stmt{mSlot->statements[sql]};
+            if (!stmt)
+            {
+                auto prepared{mSlot->con.Prepare(sql)};
+                if (prepared->HasError())
+                    throw std::runtime_error(std::format("Query error {}", prepared->GetError()));
+                stmt = std::move(prepared);
+            }
+
+            return *stmt;
+        }
+
+    private:
+        friend class ConnectionPool;
+
+        Handle(ConnectionPool& pool, std::unique_ptr<Slot> slot)
+            : mPool{&pool}
+            , mSlot{std::move(slot)}
+        {
+        }
+
+        ConnectionPool* mPool;
+        std::unique_ptr<Slot> mSlot;
+    };
+
+    // A maxConnections of 0 uses the number of cores.
+    explicit ConnectionPool(duckdb::DuckDB& db, std::size_t maxConnections = 0)
+        : mDb{db}
+        , mMaxConnections{details::num_threads(maxConnections)}
+    {
+    }
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    Handle acquire()
+    {
+        std::unique_lock lock{mMutex};
+        mReleased.wait(lock, [this] { return !mIdle.empty() || mSize < mMaxConnections; });
+
+        if (!mIdle.empty())
+        {
+            auto slot{std::move(mIdle.back())};
+            mIdle.pop_back();
+            return Handle{*this, std::move(slot)};
+        }
+
+        // Connect without holding the lock.
+        ++mSize;
+        lock.unlock();
+        try
+        {
+            return Handle{*this, std::make_unique<Slot>(mDb)};
+        }
+        catch (...)
+        {
+            lock.lock();
+            --mSize;
+            mReleased.notify_one();
+            throw;
+        }
+    }
+
+    // Runs the prepared query with params on a pooled connection and calls f with each row
+    // like for_each, the statement is prepared once per connection.
+    template <typename F, typename... Params>
+    F for_each(const std::string& sql, F f, Params&&... params)
+    {
+        auto con{acquire()};
+        auto& stmt{con.prepare(sql)};
+
+        duckdb::vector<duckdb::Value> values{
+            duckdb::Value::CreateValue(std::forward<Params>(params))...};
+        return duckforeach::for_each(stmt.Execute(values, true), std::move(f));
+    }
+
+    // Number of connections created by the pool.
+    std::size_t size() const
+    {
+        std::lock_guard lock{mMutex};
+        return mSize;
+    }
+
+private:
+    void release(std::unique_ptr<Slot> slot)
+    {
+        std::lock_guard lock{mMutex};
+        mIdle.push_back(std::move(slot));
+        mReleased.notify_one();
+    }
+
+    duckdb::DuckDB& mDb;
+    const std::size_t mMaxConnections;
+    mutable std::mutex mMutex;
+    std::condition_variable mReleased;
+    std::vector<std::unique_ptr<Slot>> mIdle;
+    std::size_t mSize{0};
+};
+
+// Iterates the rows appended to a table since the previous call, for tables where new rows
+// have increasing values in the order column, like a timestamp or a sequence id.
+//
+// The first call reads all the rows, later calls run a cached prepared statement with the
+// largest order column value read so far, the high-water mark, so that only the new rows
+// are scanned. The mark moves forward after all the rows of a chunk have been processed, if
+// f throws the rows of the current chunk are read again by the next call. Rows with a NULL
+// order value are skipped.
+class TableTail
+{
+public:
+    // table and orderCol are used in the queries as they are, columns is the select list
+    // and it must include the order column.
+    TableTail(duckdb::Connection& con,
+              std::string table,
+              std::string orderCol,
+              std::string columns = "*",
+              std::optional<duckdb::Value> mark = std::nullopt)
+        : mCon{con}
+        , mTable{std::move(table)}
+        , mOrderCol{std::move(orderCol)}
+        , mColumns{std::move(columns)}
+        , mMark{std::move(mark)}
+    {
+        if (mMark && mMark->IsNull())
+            mMark.reset();
+    }
+
+    // Calls f with each new row like for_each.
+    template <typename F> F for_each(F f)
+    {
+        duckdb::vector<duckdb::Value> params;
+        if (mMark)
+            params.push_back(*mMark);
+
+        auto result{statement().Execute(params, true)};
+        details::check_result(result);
+
+        auto it{std::ranges::find(result->names, mOrderCol)};
+        if (it == result->names.end())
+            throw std::invalid_argument{
+                std::format("Column {} is not in the tail columns", mOrderCol)};
+
+        Source source{*result, static_cast<std::size_t>(it - result->names.begin()), mMark};
+        return details::for_each_impl<F>(*result, source, std::function{f});
+    }
+
+    // The order column value of the last row read.
+    const std::optional<duckdb::Value>& high_water_mark() const
+    {
+        return mMark;
+    }
+
+private:
+    // Moves the mark to the last row of a chunk when the next chunk is fetched.
+    struct Source
+    {
+        Source(duckdb::QueryResult& result,
+               std::size_t orderCol,
+               std::optional<duckdb::Value>& mark)
+            : source{result}
+            , orderCol{orderCol}
+            , mark{mark}
+        {
+        }
+
+        duckdb::DataChunk* next()
+        {
+            if (chunk && chunk->size() > 0)
+            {
+                auto value{chunk->GetValue(orderCol, chunk->size() - 1)};
+                if (!value.IsNull())
+                    mark = std::move(value);
+            }
+
+            chunk = source.next();
+            return chunk;
+        }
+
+        details::ResultSource source;
+        std::size_t orderCol;
+        std::optional<duckdb::Value>& mark;
+        duckdb::DataChunk* chunk{nullptr};
+    };
+
+    duckdb::PreparedStatement& statement()
+    {
+        auto& stmt{mMark ? mDeltaStmt : mFullStmt};
+        if (!stmt)
+        {
+            // A NULL mark would match no later rows, so rows without an order value are
+            // never read.
+            auto sql{std::format("select {} from {} where {} is not null{} order by {}",
+                                 mColumns, mTable, mOrderCol,
+                                 mMark ? std::format(" and {} > ?", mOrderCol) : "",
+                                 mOrderCol)};
+            auto prepared{mCon.Prepare(sql)};
+            if (prepared->HasError())
+                throw std::runtime_error(std::format("Query error {}", prepared->GetError()));
+            stmt = std::move(prepared);
+        }
+
+        return *stmt;
+    }
+
+    duckdb::Connection& mCon;
+    std::string mTable;
+    std::string mOrderCol;
+    std::string mColumns;
+    std::optional<duckdb::Value> mMark;
+    std::unique_ptr<duckdb::PreparedStatement> mFullStmt;
+    std::unique_ptr<duckdb::PreparedStatement> mDeltaStmt;
+};
+
+namespace details {
+
+// Replaces the {} placeholders in sql with value.
+inline std::string replace_placeholders(std::string_view sql, std::string_view value)
+{
+    std::string out;
+    std::size_t pos{0};
+    for (auto next{sql.find("{}")}; next != std::string_view::npos; next = sql.find("{}", pos))
+    {
+        out.append(sql.substr(pos, next - pos));
+        out.append(value);
+        pos = next + 2;
+    }
+    out.append(sql.substr(pos));
+    return out;
+}
+
+inline std::string quote_literal(std::string_view value)
+{
+    std::string out{"'"};
+    for (auto c : value)
+    {
+        if (c == '\'')
+            out.push_back('\'');
+        out.push_back(c);
+    }
+    out.push_back('\'');
+    return out;
+}
+
+inline void run_statement(duckdb::Connection& con, const std::string& sql)
+{
+    auto result{con.Query(sql)};
+    if (result->HasError())
+        throw std::runtime_error{std::format("Query error {}", result->GetError())};
+}
+
+// Attaches the database file at path and calls for_each on the sqlTemplate query result.
+template <typename F>
+F scan_file(duckdb::Connection& con,
+            std::size_t idx,
+            const std::filesystem::path& path,
+            std::string_view sqlTemplate,
+            F f)
+{
+    auto alias{std::format("dfe_file_{}", idx)};
+    run_statement(con,
+                  std::format("ATTACH {} AS {} (READ_ONLY)", quote_literal(path.string()), alias));
+    run_statement(con, std::format("USE {}", alias));
+
+    auto sql{replace_placeholders(sqlTemplate, quote_literal(path.string()))};
+    auto result{for_each(con.SendQuery(sql), std::move(f))};
+
+    run_statement(con, "USE memory");
+    run_statement(con, std::format("DETACH {}", alias));
+    return result;
+}
+
+} // namespace details
+
+// Runs a query on each of the database files in paths and returns the function objects,
+// one per file in the paths order, after they have been called with the file rows.
+//
+// makeFn(const std::filesystem::path&) creates the function object for a file, it is called
+// from the worker threads one call at a time so it can use shared state. Each file
+// is attached read only to an in-memory database on its own connection and made the
+// default database, so sqlTemplate can use unqualified table names, the {} placeholders
+// in sqlTemplate are replaced with the file path as a quoted string literal. Files are
+// processed on nthreads threads (0 for the number of cores), the first exception stops
+// the remaining files and is rethrown.
+template <typename MakeFn>
+auto for_each_files(const std::vector<std::filesystem::path>& paths,
+                    std::string_view sqlTemplate,
+                    MakeFn makeFn,
+                    std::size_t nthreads = 0)
+{
+    using F = std::decay_t<std::invoke_result_t<MakeFn&, const std::filesystem::path&>>;
+
+    std::vector<std::optional<F>> states(paths.size());
+    if (!paths.empty())
+    {
+        duckdb::DuckDB db{nullptr};
+        std::atomic<std::size_t> next{0};
+        std::atomic<bool> stop{false};
+        std::mutex makeMutex;
+
+        auto work = [&](std::size_t)
+        {
+            // DuckDB skips the connection cleanup when it is destroyed during stack
+            // unwinding, so errors are rethrown after the connection is closed.
+            std::exception_ptr error;
+            {
+                duckdb::Connection con{db};
+                try
+                {
+                    for (auto idx{next++}; idx < paths.size() && !stop; idx = next++)
+                    {
+                        auto state = [&]
+                        {
+                            std::lock_guard lock{makeMutex};
+                            return F{makeFn(paths[idx])};
+                        };
+                        states[idx].emplace(
+                            details::scan_file(con, idx, paths[idx], sqlTemplate, state()));
+                    }
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+            }
+
+            if (error)
+                std::rethrow_exception(error);
+        };
+
+        details::run_threads(std::min(details::num_threads(nthreads), paths.size()), work,
+                             [&] { stop = true; });
+    }
+
+    std::vector<F> results;
+    results.reserve(states.size());
+    for (auto& state : states)
+        results.push_back(std::move(*state));
+    return results;
+}
+
+namespace details {
+
+template <typename T>
+inline constexpr bool is_valid_output_v =
+    is_valid_argument_v<T> && !std::is_same_v<optional_value_t<T>, BitView>;
+
+template <typename... Args> constexpr bool is_valid_output_signature()
+{
+    constexpr bool is_valid{(is_valid_output_v<std::decay_t<Args>> && ...)};
+    static_assert(is_valid, "Invalid output type, BitView values cannot be written");
+    return is_valid;
+}
+
+// The DuckDB type of the vectors written from T values.
+template <typename T> duckdb::LogicalType logical_type()
+{
+    using V = optional_value_t<std::decay_t<T>>;
+    using duckdb::LogicalType;
+
+    if constexpr (std::is_same_v<V, bool>)
+        return LogicalType::BOOLEAN;
+    else if constexpr (std::is_same_v<V, int8_t>)
+        return LogicalType::TINYINT;
+    else if constexpr (std::is_same_v<V, int16_t>)
+        return LogicalType::SMALLINT;
+    else if constexpr (std::is_same_v<V, int32_t>)
+        return LogicalType::INTEGER;
+    else if constexpr (std::is_same_v<V, int64_t>)
+        return LogicalType::BIGINT;
+    else if constexpr (std::is_same_v<V, uint8_t>)
+        return LogicalType::UTINYINT;
+    else if constexpr (std::is_same_v<V, uint16_t>)
+        return LogicalType::USMALLINT;
+    else if constexpr (std::is_same_v<V, uint32_t>)
+        return LogicalType::UINTEGER;
+    else if constexpr (std::is_same_v<V, uint64_t>)
+        return LogicalType::UBIGINT;
+    else if constexpr (std::is_same_v<V, float>)
+        return LogicalType::FLOAT;
+    else if constexpr (std::is_same_v<V, double>)
+        return LogicalType::DOUBLE;
+    else if constexpr (std::is_same_v<V, std::string> || std::is_same_v<V, std::string_view>)
+        return LogicalType::VARCHAR;
+    else if constexpr (std::is_same_v<V, std::span<const std::byte>>)
+        return LogicalType::BLOB;
+    else if constexpr (std::is_same_v<V, duckdb::date_t> || std::is_same_v<V, year_month_day>)
+        return LogicalType::DATE;
+    else if constexpr (std::is_same_v<V, duckdb::dtime_t> || std::is_same_v<V, hh_mm_ss>)
+        return LogicalType::TIME;
+    else if constexpr (std::is_same_v<V, duckdb::timestamp_t>)
+        return LogicalType::TIMESTAMP;
+    else if constexpr (std::is_same_v<V, Timestamp>)
+        return LogicalType::TIMESTAMP_NS;
+    else if constexpr (std::is_same_v<V, duckdb::interval_t>)
+        return LogicalType::INTERVAL;
+    else
+        static_assert(sizeof(V) == 0, "No DuckDB type for the output type");
+}
+
+// Converts values to the physical type stored in vectors, string values are copied to the
+// vector heap.
+template <typename T> T to_storage(duckdb::Vector&, const T& value)
+{
+    return value;
+}
+
+inline duckdb::string_t to_storage(duckdb::Vector& vector, const std::string& value)
+{
+    return duckdb::StringVector::AddString(vector, value);
+}
+
+inline duckdb::string_t to_storage(duckdb::Vector& vector, std::string_view value)
+{
+    return duckdb::StringVector::AddString(vector, value.data(), value.size());
+}
+
+inline duckdb::string_t to_storage(duckdb::Vector& vector, std::span<const std::byte> value)
+{
+    return duckdb::StringVector::AddStringOrBlob(
+        vector, reinterpret_cast<const char*>(value.data()), value.size());
+}
+
+inline duckdb::timestamp_t to_storage(duckdb::Vector&, const Timestamp& value)
+{
+    return duckdb::timestamp_t{value.time().time_since_epoch().count()};
+}
+
+inline duckdb::date_t to_storage(duckdb::Vector&, const year_month_day& value)
+{
+    return duckdb::date_t{
+        static_cast<int32_t>(std::chrono::sys_days{value}.time_since_epoch().count())};
+}
+
+inline duckdb::dtime_t to_storage(duckdb::Vector&, const hh_mm_ss& value)
+{
+    return duckdb::dtime_t{
+        std::chrono::duration_cast<std::chrono::microseconds>(value.to_duration()).count()};
+}
+
+// Writes value at row of a flat vector, std::nullopt values are written as NULL.
+template <typename T> void write_value(duckdb::Vector& vector, duckdb::idx_t row, const T& value)
+{
+    if constexpr (is_optional_v<T>)
+    {
+        if (value)
+            write_value(vector, row, *value);
+        else
+            duckdb::FlatVector::SetNull(vector, row, true);
+    }
+    else
+    {
+        using Storage = decltype(to_storage(vector, value));
+        duckdb::FlatVector::GetData<Storage>(vector)[row] = to_storage(vector, value);
+    }
+}
+
+// Writes the projected columns of a row, columnIds maps the chunk columns to row elements.
+template <typename... Args, typename Row>
+void write_row(duckdb::DataChunk& chunk,
+               duckdb::idx_t row,
+               std::span<const duckdb::column_t> columnIds,
+               const Row& values)
+{
+    for (std::size_t col{0}; col < columnIds.size(); ++col)
+    {
+        [&]<std::size_t... Is>(std::index_sequence<Is...>)
+        {
+            ((columnIds[col] == Is
+                  ? write_value<Args>(chunk.data[col], row, std::get<Is>(values))
+                  : void()),
+             ...);
+        }(std::index_sequence_for<Args...>{});
+    }
+}
+
+// The generator of a registered table function, each scan calls makeFill to get the
+// function that writes the next chunk of rows and returns the number of rows written.
+class TableGenerator : public duckdb::TableFunctionInfo
+{
+public:
+    using Fill =
+        std::function<duckdb::idx_t(duckdb::DataChunk&, std::span<const duckdb::column_t>)>;
+
+    TableGenerator(std::vector<std::string> names, std::function<Fill()> makeFill)
+        : mNames{std::move(names)}
+        , mMakeFill{std::move(makeFill)}
+    {
+    }
+
+    const std::vector<std::string>& names() const
+    {
+        return mNames;
+    }
+
+    Fill make_fill() const
+    {
+        return mMakeFill();
+    }
+
+private:
+    std::vector<std::string> mNames;
+    std::function<Fill()> mMakeFill;
+};
+
+struct TableGeneratorData : public duckdb::TableFunctionData
+{
+    const TableGenerator* generator{nullptr};
+
+    duckdb::unique_ptr<duckdb::FunctionData> Copy() const override
+    {
+        auto data{duckdb::make_uniq<TableGeneratorData>()};
+        data->generator = generator;
+        return std::move(data);
+    }
+
+    bool Equals(const duckdb::FunctionData& other) const override
+    {
+        return generator == other.Cast<TableGeneratorData>().generator;
+    }
+};
+
+struct TableGeneratorState : public duckdb::GlobalTableFunctionState
+{
+    TableGenerator::Fill fill;
+    std::vector<duckdb::column_t> columnIds;
+};
+
+template <typename... Args> struct TableGeneratorFunction
+{
+    static duckdb::unique_ptr<duckdb::FunctionData> bind(duckdb::ClientContext&,
+                                                         duckdb::TableFunctionBindInput& input,
+                                                         duckdb::vector<duckdb::LogicalType>& types,
+                                                         duckdb::vector<std::string>& names)
+    {
+        auto& generator{input.info->Cast<TableGenerator>()};
+        types = {logical_type<Args>()...};
+        names.assign(generator.names().begin(), generator.names().end());
+
+        auto data{duckdb::make_uniq<TableGeneratorData>()};
+        data->generator = &generator;
+        return std::move(data);
+    }
+
+    static duckdb::unique_ptr<duckdb::GlobalTableFunctionState>
+    init(duckdb::ClientContext&, duckdb::TableFunctionInitInput& input)
+    {
+        auto state{duckdb::make_uniq<TableGeneratorState>()};
+        state->fill = input.bind_data->Cast<TableGeneratorData>().generator->make_fill();
+        state->columnIds.assign(input.column_ids.begin(), input.column_ids.end());
+        return std::move(state);
+    }
+
+    static void scan(duckdb::ClientContext&,
+                     duckdb::TableFunctionInput& input,
+                     duckdb::DataChunk& output)
+    {
+        auto& state{input.global_state->Cast<TableGeneratorState>()};
+        output.SetCardinality(state.fill(output, state.columnIds));
+    }
+};
+
+} // namespace details
+
+// Registers a table function name on the database of con that produces the rows of
+// generator, the Args types set the columns types, like register_table_function<int64_t,
+// std::string>(con, "labels", rows), and the table is queried with select * from labels().
+//
+// generator is either a forward range of std::tuple<Args...> rows, read from the start by
+// each query, or a function object returning std::optional<std::tuple<Args...>> that is
+// copied for each query and called until it returns std::nullopt. Rows are written to the
+// output chunks directly, only the columns used by the query are written. Columns are
+// named by columnNames, or col0, col1... when empty.
+template <typename... Args, typename G>
+void register_table_function(duckdb::Connection& con,
+                             const std::string& name,
+                             G generator,
+                             std::vector<std::string> columnNames = {})
+{
+    static_assert(sizeof...(Args) > 0, "A table function needs at least one column");
+
+    if constexpr (details::is_valid_output_signature<Args...>())
+    {
+        if (columnNames.empty())
+        {
+            for (std::size_t col{0}; col < sizeof...(Args); ++col)
+                columnNames.push_back(std::format("col{}", col));
+        }
+        if (columnNames.size() != sizeof...(Args))
+            throw std::invalid_argument{std::format("Invalid number of column names {}, "
+                                                    "the table function has {} columns",
+                                                    columnNames.size(), sizeof...(Args))};
+
+        using Fill = details::TableGenerator::Fill;
+        std::function<Fill()> makeFill;
+
+        if constexpr (std::ranges::forward_range<G>)
+        {
+            makeFill = [rows = std::make_shared<G>(std::move(generator))]() -> Fill
+            {
+                return [rows, it = std::ranges::begin(*rows)](
+                           duckdb::DataChunk& chunk,
+                           std::span<const duckdb::column_t> columnIds) mutable
+                {
+                    duckdb::idx_t count{0};
+                    for (auto end{std::ranges::end(*rows)};
+                         it != end && count < STANDARD_VECTOR_SIZE; ++it, ++count)
+                        details::write_row<Args...>(chunk, count, columnIds, *it);
+                    return count;
+                };
+            };
+        }
+        else
+        {
+            static_assert(std::is_invocable_v<G&>,
+                          "The generator must be a forward range or a function object");
+
+            makeFill = [generator = std::move(generator)]() -> Fill
+            {
+                return [next = generator, done = false](
+                           duckdb::DataChunk& chunk,
+                           std::span<const duckdb::column_t> columnIds) mutable
+                {
+                    duckdb::idx_t count{0};
+                    while (!done && count < STANDARD_VECTOR_SIZE)
+                    {
+                        auto row{next()};
+                        done = !row;
+                        if (row)
+                            details::write_row<Args...>(chunk, count++, columnIds, *row);
+                    }
+                    return count;
+                };
+            };
+        }
+
+        using Function = details::TableGeneratorFunction<Args...>;
+        duckdb::TableFunction function{name, {}, &Function::scan, &Function::bind,
+                                       &Function::init};
+        function.projection_pushdown = true;
+        function.function_info = duckdb::make_shared_ptr<details::TableGenerator>(
+            std::move(columnNames), std::move(makeFill));
+
+        duckdb::CreateTableFunctionInfo info{std::move(function)};
+        info.on_conflict = duckdb::OnCreateConflict::REPLACE_ON_CONFLICT;
+        con.context->RegisterFunction(info);
+    }
+}
+
+namespace details {
+
+// The physical type of the vectors written from T values.
+template <typename T>
+using storage_t = decltype(to_storage(std::declval<duckdb::Vector&>(), std::declval<const T&>()));
+
+// Converts a vector value back to T, the reverse of to_storage.
+template <typename T> void from_storage(const T& value, T& out)
+{
+    out = value;
+}
+
+inline void from_storage(const duckdb::string_t& value, std::string& out)
+{
+    out.assign(value.GetData(), value.GetSize());
+}
+
+inline void from_storage(const duckdb::string_t& value, std::string_view& out)
+{
+    out = {value.GetData(), value.GetSize()};
+}
+
+inline void from_storage(const duckdb::string_t& value, std::span<const std::byte>& out)
+{
+    out = {reinterpret_cast<const std::byte*>(value.GetData()), value.GetSize()};
+}
+
+inline void from_storage(const duckdb::timestamp_t& value, Timestamp& out)
+{
+    out = Timestamp{Timestamp::TimeType{std::chrono::nanoseconds{value.value}}};
+}
+
+inline void from_storage(const duckdb::date_t& value, year_month_day& out)
+{
+    out = year_month_day{std::chrono::sys_days{std::chrono::days{value.days}}};
+}
+
+inline void from_storage(const duckdb::dtime_t& value, hh_mm_ss& out)
+{
+    out = hh_mm_ss{std::chrono::microseconds{value.micros}};
+}
+
+// Reads the arguments at row, returns false if a NULL value is passed to an argument
+// that is not a std::optional.
+template <typename Values, std::size_t... Is>
+bool read_arguments(std::span<const duckdb::UnifiedVectorFormat> formats,
+                    duckdb::idx_t row,
+                    Values& values,
+                    std::index_sequence<Is...>)
+{
+    auto read = [&]<std::size_t I>(std::integral_constant<std::size_t, I>)
+    {
+        using T = std::tuple_element_t<I, Values>;
+        using V = optional_value_t<T>;
+
+        auto& format{formats[I]};
+        auto idx{format.sel->get_index(row)};
+        auto& out{std::get<I>(values)};
+
+        if (!format.validity.RowIsValid(idx))
+        {
+            if constexpr (is_optional_v<T>)
+                out.reset();
+            return is_optional_v<T>;
+        }
+
+        auto data{duckdb::UnifiedVectorFormat::GetData<storage_t<V>>(format)};
+        if constexpr (is_optional_v<T>)
+            from_storage(data[idx], out ? *out : out.emplace());
+        else
+            from_storage(data[idx], out);
+        return true;
+    };
+
+    return (read(std::integral_constant<std::size_t, Is>{}) && ...);
+}
+
+template <typename R, typename... Args>
+void register_scalar_impl(duckdb::Connection& con,
+                          const std::string& name,
+                          std::function<R(Args...)>&& f)
+{
+    if constexpr (is_valid_output_signature<R, Args...>())
+    {
+        auto function = [f = std::move(f)](duckdb::DataChunk& args, duckdb::ExpressionState&,
+                                           duckdb::Vector& result)
+        {
+            constexpr auto numArgs{sizeof...(Args)};
+            auto count{args.size()};
+
+            std::array<duckdb::UnifiedVectorFormat, numArgs> formats;
+            bool allConstant{true};
+            for (std::size_t col{0}; col < numArgs; ++col)
+            {
+                auto& vector{args.data[col]};
+                allConstant = allConstant &&
+                              vector.GetVectorType() == duckdb::VectorType::CONSTANT_VECTOR;
+                vector.ToUnifiedFormat(count, formats[col]);
+            }
+
+            // Constant inputs produce a constant result computed once.
+            if (allConstant && count > 0)
+                count = 1;
+
+            result.SetVectorType(duckdb::VectorType::FLAT_VECTOR);
+            std::tuple<std::decay_t<Args>...> values;
+            for (duckdb::idx_t row{0}; row < count; ++row)
+            {
+                if (read_arguments(formats, row, values, std::index_sequence_for<Args...>{}))
+                    write_value(result, row, std::apply(f, values));
+                else
+                    duckdb::FlatVector::SetNull(result, row, true);
+            }
+
+            if (allConstant)
+                result.SetVectorType(duckdb::VectorType::CONSTANT_VECTOR);
+        };
+
+        con.CreateVectorizedFunction(name, {logical_type<std::decay_t<Args>>()...},
+                                     logical_type<R>(), std::move(function));
+    }
+}
+
+} // namespace details
+
+// Registers f as the SQL scalar function name on the database of con, the SQL argument
+// and return types are deduced from f like in for_each, for example:
+//
+//   dfe::register_scalar(con, "mid", [](double bid, double ask) { return (bid + ask) / 2; });
+//
+// f runs inside the DuckDB pipelines one chunk at a time, the argument vectors are read in
+// place and the results written directly to the output vector. NULL values are passed to
+// std::optional arguments, for other arguments the result is NULL without calling f, and
+// f can return a std::optional for NULL results. f is called concurrently by DuckDB
+// threads so it must be safe to call from multiple threads.
+template <typename F> void register_scalar(duckdb::Connection& con, const std::string& name, F f)
+{
+    details::register_scalar_impl(con, name, std::function{f});
+}
+
+namespace details {
+
+// Calls the update, combine and finalize functions of a registered aggregate from the
+// DuckDB aggregate callbacks, the functions are found with the bind data.
+template <typename State, typename Update, typename Combine, typename Finalize, typename... Args>
+struct AggregateBridge
+{
+    using Values = std::tuple<std::decay_t<Args>...>;
+    using Result = std::decay_t<std::invoke_result_t<const Finalize&, const State&>>;
+
+    struct Functions
+    {
+        Update update;
+        Combine combine;
+        Finalize finalize;
+    };
+
+    struct Data : public duckdb::FunctionData
+    {
+        std::shared_ptr<const Functions> functions;
+
+        duckdb::unique_ptr<duckdb::FunctionData> Copy() const override
+        {
+            auto data{duckdb::make_uniq<Data>()};
+            data->functions = functions;
+            return std::move(data);
+        }
+
+        bool Equals(const duckdb::FunctionData& other) const override
+        {
+            return functions == other.Cast<Data>().functions;
+        }
+    };
+
+    // The function pointers callbacks cannot capture, the functions are registered by
+    // database and name and looked up when a query binds the aggregate. Entries hold the
+    // database weakly, the entries of closed databases are released by the next
+    // registration so an address reused by a new database never sees stale functions.
+    struct Entry
+    {
+        duckdb::weak_ptr<duckdb::DatabaseInstance> db;
+        std::shared_ptr<const Functions> functions;
+    };
+
+    using Key = std::pair<const duckdb::DatabaseInstance*, std::string>;
+    static inline std::mutex registryMutex;
+    static inline std::map<Key, Entry> registry;
+
+    static void add(duckdb::Connection& con, const std::string& name, Functions functions)
+    {
+        std::lock_guard lock{registryMutex};
+        std::erase_if(registry, [](const auto& item) { return item.second.db.expired(); });
+        registry[{con.context->db.get(), name}] =
+            Entry{con.context->db, std::make_shared<const Functions>(std::move(functions))};
+    }
+
+    static duckdb::unique_ptr<duckdb::FunctionData>
+    bind(duckdb::ClientContext& context,
+         duckdb::AggregateFunction& function,
+         duckdb::vector<duckdb::unique_ptr<duckdb::Expression>>&)
+    {
+        auto data{duckdb::make_uniq<Data>()};
+        {
+            std::lock_guard lock{registryMutex};
+            data->functions = registry.at({context.db.get(), function.name}).functions;
+        }
+        return std::move(data);
+    }
+
+    static duckdb::idx_t state_size()
+    {
+        return sizeof(State);
+    }
+
+    static void initialize(duckdb::data_ptr_t state)
+    {
+        new (state) State{};
+    }
+
+    // Calls update for the rows with valid arguments, stateAt(row) returns the row state.
+    template <typename StateAt>
+    static void update_rows(duckdb::Vector inputs[],
+                            duckdb::AggregateInputData& input,
+                            duckdb::idx_t count,
+                            StateAt&& stateAt)
+    {
+        auto& functions{*input.bind_data->Cast<Data>().functions};
+
+        std::array<duckdb::UnifiedVectorFormat, sizeof...(Args)> formats;
+        for (std::size_t col{0}; col < formats.size(); ++col)
+            inputs[col].ToUnifiedFormat(count, formats[col]);
+
+        Values values;
+        for (duckdb::idx_t row{0}; row < count; ++row)
+        {
+            if (read_arguments(formats, row, values, std::index_sequence_for<Args...>{}))
+            {
+                std::apply([&](auto&... args) { functions.update(stateAt(row), args...); },
+                           values);
+            }
+        }
+    }
+
+    static void update(duckdb::Vector inputs[],
+                       duckdb::AggregateInputData& input,
+                       duckdb::idx_t,
+                       duckdb::Vector& states,
+                       duckdb::idx_t count)
+    {
+        duckdb::UnifiedVectorFormat format;
+        states.ToUnifiedFormat(count, format);
+        auto data{duckdb::UnifiedVectorFormat::GetData<State*>(format)};
+
+        update_rows(inputs, input, count,
+                    [&](duckdb::idx_t row) -> State& { return *data[format.sel->get_index(row)]; });
+    }
+
+    static void simple_update(duckdb::Vector inputs[],
+                              duckdb::AggregateInputData& input,
+                              duckdb::idx_t,
+                              duckdb::data_ptr_t state,
+                              duckdb::idx_t count)
+    {
+        update_rows(inputs, input, count,
+                    [&](duckdb::idx_t) -> State& { return *reinterpret_cast<State*>(state); });
+    }
+
+    static void combine(duckdb::Vector& source,
+                        duckdb::Vector& target,
+                        duckdb::AggregateInputData& input,
+                        duckdb::idx_t count)
+    {
+        auto& functions{*input.bind_data->Cast<Data>().functions};
+        auto sources{duckdb::FlatVector::GetData<const State*>(source)};
+        auto targets{duckdb::FlatVector::GetData<State*>(target)};
+
+        for (duckdb::idx_t i{0}; i < count; ++i)
+            functions.combine(*targets[i], *sources[i]);
+    }
+
+    static void finalize(duckdb::Vector& states,
+                         duckdb::AggregateInputData& input,
+                         duckdb::Vector& result,
+                         duckdb::idx_t count,
+                         duckdb::idx_t offset)
+    {
+        auto& functions{*input.bind_data->Cast<Data>().functions};
+
+        if (states.GetVectorType() == duckdb::VectorType::CONSTANT_VECTOR)
+        {
+            auto state{duckdb::ConstantVector::GetData<const State*>(states)[0]};
+            result.SetVectorType(duckdb::VectorType::FLAT_VECTOR);
+            write_value(result, 0, functions.finalize(*state));
+            result.SetVectorType(duckdb::VectorType::CONSTANT_VECTOR);
+            return;
+        }
+
+        auto data{duckdb::FlatVector::GetData<const State*>(states)};
+        for (duckdb::idx_t i{0}; i < count; ++i)
+            write_value(result, i + offset, functions.finalize(*data[i]));
+    }
+
+    static void destroy(duckdb::Vector& states, duckdb::AggregateInputData&, duckdb::idx_t count)
+    {
+        duckdb::UnifiedVectorFormat format;
+        states.ToUnifiedFormat(count, format);
+        auto data{duckdb::UnifiedVectorFormat::GetData<State*>(format)};
+
+        for (duckdb::idx_t i{0}; i < count; ++i)
+            data[format.sel->get_index(i)]->~State();
+    }
+};
+
+// DuckDB places aggregate states at 8 byte aligned offsets in its hash tables and windows.
+template <typename State> inline constexpr bool is_aggregate_state_v = alignof(State) <= 8;
+
+template <typename State, typename Update, typename Combine, typename Finalize, typename... Args>
+void register_aggregate_impl(duckdb::Connection& con,
+                             const std::string& name,
+                             Update update,
+                             Combine combine,
+                             Finalize finalize,
+                             std::function<void(State&, Args...)>*)
+{
+    using Bridge = AggregateBridge<State, Update, Combine, Finalize, Args...>;
+
+    static_assert(std::is_invocable_v<const Combine&, State&, const State&>,
+                  "combine must be callable as combine(State&, const State&)");
+    static_assert(is_aggregate_state_v<State>,
+                  "Aggregate states must be aligned to at most 8 bytes, DuckDB does not align "
+                  "the states further");
+
+    if constexpr (is_valid_output_signature<typename Bridge::Result, Args...>())
+    {
+        Bridge::add(con, name, {std::move(update), std::move(combine), std::move(finalize)});
+
+        con.CreateAggregateFunction(
+            name, {logical_type<std::decay_t<Args>>()...}, logical_type<typename Bridge::Result>(),
+            &Bridge::state_size, &Bridge::initialize, &Bridge::update, &Bridge::combine,
+            &Bridge::finalize, &Bridge::simple_update, &Bridge::bind,
+            std::is_trivially_destructible_v<State> ? nullptr : &Bridge::destroy);
+    }
+}
+
+} // namespace details
+
+// Registers a SQL aggregate function name on the database of con that runs in the DuckDB
+// parallel hash aggregate, each group has a State, default constructed, that is updated
+// with update(State&, Args...) for each row, where the SQL argument types are deduced from
+// Args like in for_each. States computed on different threads are merged with
+// combine(State&, const State&) and finalize(const State&) returns the group result,
+// returning std::nullopt from a std::optional result gives NULL.
+//
+// Rows with a NULL value for an argument that is not a std::optional are skipped. The
+// functions are called concurrently by DuckDB threads so they must not modify shared data.
+// The functions of a closed database are released when functions of the same types are
+// registered again.
+template <typename State, typename Update, typename Combine, typename Finalize>
+void register_aggregate(duckdb::Connection& con,
+                        const std::string& name,
+                        Update update,
+                        Combine combine,
+                        Finalize finalize)
+{
+    using UpdateFunction = decltype(std::function{update});
+    details::register_aggregate_impl<State>(con, name, std::move(update), std::move(combine),
+                                            std::move(finalize),
+                                            static_cast<UpdateFunction*>(nullptr));
+}
+
+namespace details {
+
+inline std::string quote_identifier(std::string_view name)
+{
+    std::string out{"\""};
+    for (auto c : name)
+    {
+        if (c == '"')
+            out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+    return out;
+}
+
+// Converts a filter value to a parameter with the DuckDB type of logical_type<T>().
+template <typename T> duckdb::Value to_value(const T& value)
+{
+    return duckdb::Value::CreateValue(value);
+}
+
+inline duckdb::Value to_value(const std::string& value)
+{
+    return duckdb::Value{value};
+}
+
+inline duckdb::Value to_value(std::string_view value)
+{
+    return duckdb::Value{std::string{value}};
+}
+
+inline duckdb::Value to_value(std::span<const std::byte> value)
+{
+    return duckdb::Value::BLOB(reinterpret_cast<duckdb::const_data_ptr_t>(value.data()),
+                               value.size());
+}
+
+inline duckdb::Value to_value(const Timestamp& value)
+{
+    return duckdb::Value::TIMESTAMPNS(
+        duckdb::timestamp_t{value.time().time_since_epoch().count()});
+}
+
+inline duckdb::Value to_value(const year_month_day& value)
+{
+    return duckdb::Value::DATE(duckdb::date_t{
+        static_cast<int32_t>(std::chrono::sys_days{value}.time_since_epoch().count())});
+}
+
+inline duckdb::Value to_value(const hh_mm_ss& value)
+{
+    return duckdb::Value::TIME(duckdb::dtime_t{
+        std::chrono::duration_cast<std::chrono::microseconds>(value.to_duration()).count()});
+}
+
+} // namespace details
+
+// A boolean SQL expression built from typed column comparisons, the compared values are
+// kept as parameters so that filters with the same shape have the same SQL.
+class Filter
+{
+public:
+    explicit Filter(std::string sql, duckdb::vector<duckdb::Value> parameters = {})
+        : mSql{std::move(sql)}
+        , mParameters{std::move(parameters)}
+    {
+    }
+
+    // The expression with a ? placeholder for each parameter.
+    const std::string& sql() const
+    {
+        return mSql;
+    }
+
+    const duckdb::vector<duckdb::Value>& parameters() const
+    {
+        return mParameters;
+    }
+
+    friend Filter operator&&(Filter lhs, Filter rhs)
+    {
+        return combine(std::move(lhs), "AND", std::move(rhs));
+    }
+
+    friend Filter operator||(Filter lhs, Filter rhs)
+    {
+        return combine(std::move(lhs), "OR", std::move(rhs));
+    }
+
+    friend Filter operator!(Filter expr)
+    {
+        return Filter{std::format("(NOT {})", expr.mSql), std::move(expr.mParameters)};
+    }
+
+private:
+    static Filter combine(Filter lhs, std::string_view op, Filter rhs)
+    {
+        lhs.mParameters.insert(lhs.mParameters.end(), rhs.mParameters.begin(),
+                               rhs.mParameters.end());
+        return Filter{std::format("({} {} {})", lhs.mSql, op, rhs.mSql),
+                      std::move(lhs.mParameters)};
+    }
+
+    std::string mSql;
+    duckdb::vector<duckdb::Value> mParameters;
+};
+
+// A column in a Filter, comparisons accept values convertible to T, a type that for_each
+// can read, and NULL values never match them like in SQL.
+template <typename T> class col
+{
+    static_assert(details::is_valid_output_v<T> && !details::is_optional_v<T>,
+                  "Invalid column type T");
+
+public:
+    explicit col(std::string_view name)
+        : mName{details::quote_identifier(name)}
+    {
+    }
+
+    Filter is_null() const
+    {
+        return Filter{std::format("({} IS NULL)", mName)};
+    }
+
+    Filter is_not_null() const
+    {
+        return Filter{std::format("({} IS NOT NULL)", mName)};
+    }
+
+    template <std::convertible_to<T> U> friend Filter operator==(const col& lhs, const U& rhs)
+    {
+        return lhs.compare("=", rhs);
+    }
+
+    template <std::convertible_to<T> U> friend Filter operator!=(const col& lhs, const U& rhs)
+    {
+        return lhs.compare("<>", rhs);
+    }
+
+    template <std::convertible_to<T> U> friend Filter operator<(const col& lhs, const U& rhs)
+    {
+        return lhs.compare("<", rhs);
+    }
+
+    template <std::convertible_to<T> U> friend Filter operator<=(const col& lhs, const U& rhs)
+    {
+        return lhs.compare("<=", rhs);
+    }
+
+    template <std::convertible_to<T> U> friend Filter operator>(const col& lhs, const U& rhs)
+    {
+        return lhs.compare(">", rhs);
+    }
+
+    template <std::convertible_to<T> U> friend Filter operator>=(const col& lhs, const U& rhs)
+    {
+        return lhs.compare(">=", rhs);
+    }
+
+private:
+    Filter compare(std::string_view op, const T& value) const
+    {
+        return Filter{std::format("({} {} ?)", mName, op), {details::to_value(value)}};
+    }
+
+    std::string mName;
+};
+
+// Runs filtered scans of a table, a Filter becomes the WHERE clause of a prepared statement
+// cached by the filter SQL, so that DuckDB skips the row groups whose min/max statistics
+// don't match instead of passing all the rows to f.
+class TableScan
+{
+public:
+    // table and columns are used in the queries as they are.
+    TableScan(duckdb::Connection& con, std::string table, std::string columns = "*")
+        : mCon{con}
+        , mTable{std::move(table)}
+        , mColumns{std::move(columns)}
+    {
+    }
+
+    // Calls f with each row that matches filter like for_each.
+    template <typename F> F for_each(const Filter& filter, F f)
+    {
+        auto params{filter.parameters()};
+        return duckforeach::for_each(statement(filter.sql()).Execute(params, true),
+                                     std::move(f));
+    }
+
+private:
+    duckdb::PreparedStatement& statement(const std::string& where)
+    {
+        auto& stmt{mStatements[where]};
+        if (!stmt)
+        {
+            auto prepared{
+                mCon.Prepare(std::format("select {} from {} where {}", mColumns, mTable, where))};
+            if (prepared->HasError())
+                throw std::runtime_error(std::format("Query error {}", prepared->GetError()));
+            stmt = std::move(prepared);
+        }
+
+        return *stmt;
+    }
+
+    duckdb::Connection& mCon;
+    std::string mTable;
+    std::string mColumns;
+    std::unordered_map<std::string, std::unique_ptr<duckdb::PreparedStatement>> mStatements;
+};
+
+// How a fraction of the table rows is sampled.
+enum class SampleMethod
+{
+    // Whole vectors of rows, the fastest method.
+    system,
+    // Each row with the sample probability.
+    bernoulli,
+    // A uniform sample collected in a reservoir.
+    reservoir,
+};
+
+// Options for for_each_sample.
+struct SampleOptions
+{
+    // The select list, it is used in the query as it is.
+    std::string columns{"*"};
+    // Method for fraction sizes, a number of rows is always sampled with a reservoir.
+    SampleMethod method{SampleMethod::system};
+    // Seed for a repeatable sample, DuckDB repeats a sample only when the query runs on a
+    // single thread.
+    std::optional<int64_t> seed{};
+    // Visits the sample chunks in random order so that the rows processed before stopping
+    // are a sample of the whole table, the sample is materialized.
+    bool random_order{false};
+};
+
+namespace details {
+
+// Booleans and characters are integral types that are not numbers of rows.
+template <typename T>
+inline constexpr bool is_character_v =
+    std::is_same_v<T, bool> || std::is_same_v<T, char> || std::is_same_v<T, wchar_t> ||
+    std::is_same_v<T, char8_t> || std::is_same_v<T, char16_t> || std::is_same_v<T, char32_t>;
+
+inline const char* sample_method_name(SampleMethod method)
+{
+    switch (method)
+    {
+    case SampleMethod::bernoulli:
+        return "bernoulli";
+    case SampleMethod::reservoir:
+        return "reservoir";
+    default:
+        return "system";
+    }
+}
+
+// Fetches the chunks of a materialized result in random order.
+class ShuffledSource
+{
+public:
+    ShuffledSource(duckdb::QueryResult& result, uint64_t seed)
+        : mCollection{result.Cast<duckdb::MaterializedQueryResult>().Collection()}
+        , mOrder(mCollection.ChunkCount())
+    {
+        std::iota(mOrder.begin(), mOrder.end(), duckdb::idx_t{0});
+        std::shuffle(mOrder.begin(), mOrder.end(), std::mt19937_64{seed});
+        mCollection.InitializeScanChunk(mChunk);
+    }
+
+    duckdb::DataChunk* next()
+    {
+        if (mNext == mOrder.size())
+            return nullptr;
+
+        mChunk.Reset();
+        mCollection.FetchChunk(mOrder[mNext++], mChunk);
+        return &mChunk;
+    }
+
+private:
+    duckdb::ColumnDataCollection& mCollection;
+    std::vector<duckdb::idx_t> mOrder;
+    std::size_t mNext{0};
+    duckdb::DataChunk mChunk;
+};
+
+} // namespace details
+
+// Calls f with the rows of a sample of table like for_each, size is the fraction of the
+// rows to sample, in [0, 1], if it is a floating point number and the number of rows if
+// it is an integer. table is used in the query as it is, so it can also be a subquery.
+template <typename N, typename F>
+    requires std::floating_point<N> || (std::integral<N> && !details::is_character_v<N>)
+F for_each_sample(duckdb::Connection& con,
+                  std::string_view table,
+                  N size,
+                  F f,
+                  const SampleOptions& options = {})
+{
+    std::string sampleSize;
+    std::string_view method{"reservoir"};
+    if constexpr (std::is_floating_point_v<N>)
+    {
+        if (!(size >= 0 && size <= 1))
+            throw std::invalid_argument{
+                std::format("Sample fraction {} is not between 0 and 1", size)};
+        sampleSize = std::format("{}%", static_cast<double>(size) * 100);
+        method = details::sample_method_name(options.method);
+    }
+    else
+    {
+        if (std::cmp_less(size, 0))
+            throw std::invalid_argument{std::format("Invalid sample size {}", size)};
+        sampleSize = std::format("{} ROWS", size);
+    }
+
+    auto sql{std::format("select {} from {} using sample {} ({}{})", options.columns, table,
+                         sampleSize, method,
+                         options.seed ? std::format(", {}", *options.seed) : "")};
+
+    if (!options.random_order)
+        return for_each(con.SendQuery(sql), std::move(f));
+
+    std::unique_ptr<duckdb::QueryResult> result{con.Query(sql)};
+    details::check_result(result);
+
+    auto seed{options.seed ? static_cast<uint64_t>(*options.seed) : std::random_device{}()};
+    details::ShuffledSource source{*result, seed};
+    return details::for_each_impl<F>(*result, source, std::function{f});
+}
+
+// Options for for_each_checkpointed.
+struct CheckpointOptions
+{
+    // Key of the last row processed by a previous run, the iteration resumes after it.
+    std::optional<duckdb::Value> resume_after{};
+    // Minimum number of rows between checkpoints, checkpoints are taken after a chunk.
+    std::size_t interval_rows{100'000};
+};
+
+namespace details {
+
+template <typename F, typename OnCheckpoint, typename R, typename... Args>
+auto checkpointed_impl(duckdb::QueryResult& result,
+                       std::size_t keyCol,
+                       std::function<R(Args...)>&& f,
+                       OnCheckpoint& onCheckpoint,
+                       std::size_t intervalRows)
+{
+    auto& fn{*f.template target<F>()};
+
+    if constexpr (is_valid_signature<Args...>())
+    {
+        check_columns<Args...>(result);
+
+        RowConverter<Args...> converter;
+        ResultSource source{result};
+        std::optional<duckdb::Value> key;
+        std::size_t firstRow{0};
+        std::size_t pendingRows{0};
+        while (auto chunk{source.next()})
+        {
+            if (chunk->size() == 0)
+                continue;
+
+            converter.for_each_row(*chunk, firstRow, fn);
+            firstRow += chunk->size();
+            pendingRows += chunk->size();
+
+            key = chunk->GetValue(keyCol, chunk->size() - 1);
+            if (key->IsNull())
+                throw std::invalid_argument{
+                    std::format("Checkpoint key at column {} is NULL", keyCol + 1)};
+
+            if (pendingRows >= intervalRows)
+            {
+                onCheckpoint(*key, std::as_const(fn));
+                pendingRows = 0;
+            }
+        }
+
+        check_stream_error(result);
+
+        if (pendingRows > 0)
+            onCheckpoint(*key, std::as_const(fn));
+    }
+
+    return fn;
+}
+
+} // namespace details
+
+// Calls f with each row of query like for_each and after every options.interval_rows rows,
+// and at the end, calls onCheckpoint(const duckdb::Value& key, const F& f) with the key
+// column value of the last row processed, so that onCheckpoint can save the key and the
+// state of f. A failed run is resumed by passing f restored from the saved state and the
+// key as options.resume_after.
+//
+// query must be ordered by keyCol with unique and not NULL keys, a resumed run selects
+// the rows of query with a key greater than resume_after ordered by keyCol.
+template <typename F, typename OnCheckpoint>
+F for_each_checkpointed(duckdb::Connection& con,
+                        const std::string& query,
+                        const std::string& keyCol,
+                        F f,
+                        OnCheckpoint onCheckpoint,
+                        const CheckpointOptions& options = {})
+{
+    if (options.interval_rows == 0)
+        throw std::invalid_argument{"Checkpoint interval_rows must be greater than zero."};
+
+    std::unique_ptr<duckdb::PreparedStatement> stmt;
+    std::unique_ptr<duckdb::QueryResult> result;
+    if (options.resume_after)
+    {
+        auto key{details::quote_identifier(keyCol)};
+        stmt = con.Prepare(
+            std::format("select * from ({}) where {} > ? order by {}", query, key, key));
+        if (stmt->HasError())
+            throw std::runtime_error(std::format("Query error {}", stmt->GetError()));
+
+        duckdb::vector<duckdb::Value> params{*options.resume_after};
+        result = stmt->Execute(params, true);
+    }
+    else
+    {
+        result = con.SendQuery(query);
+    }
+    details::check_result(result);
+
+    auto it{std::ranges::find(result->names, keyCol)};
+    if (it == result->names.end())
+        throw std::invalid_argument{std::format("Column {} is not in the query columns", keyCol)};
+
+    return details::checkpointed_impl<F>(*result,
+                                         static_cast<std::size_t>(it - result->names.begin()),
+                                         std::function{f}, onCheckpoint, options.interval_rows);
+}
+
+namespace details {
+
+// Passes the results of chunks processed in parallel to a single consumer in chunk order,
+// a producer blocks while its chunk is capacity chunks ahead of the next one to consume.
+template <typename T> class ReorderBuffer
+{
+public:
+    explicit ReorderBuffer(std::size_t capacity)
+        : mCapacity{std::max<std::size_t>(capacity, 1)}
+    {
+    }
+
+    // Adds the item of chunk seq, returns false if the buffer has been closed.
+    bool push(std::size_t seq, T item)
+    {
+        std::unique_lock lock{mMutex};
+        mNotFull.wait(lock, [&] { return mClosed || seq < mNext + mCapacity; });
+        if (mClosed)
+            return false;
+
+        mItems.emplace(seq, std::move(item));
+        mReady.notify_all();
+        return true;
+    }
+
+    // Returns the item of the next chunk or std::nullopt after the last one.
+    std::optional<T> pop()
+    {
+        std::unique_lock lock{mMutex};
+        mReady.wait(lock,
+                    [this]
+                    {
+                        return mClosed || mItems.contains(mNext) ||
+                               (mNumChunks && mNext == *mNumChunks);
+                    });
+
+        auto it{mItems.find(mNext)};
+        if (mClosed || it == mItems.end())
+            return std::nullopt;
+
+        auto item{std::move(it->second)};
+        mItems.erase(it);
+        ++mNext;
+        mNotFull.notify_all();
+        return item;
+    }
+
+    // Sets the number of chunks once they have all been fetched.
+    void finish(std::size_t numChunks)
+    {
+        std::lock_guard lock{mMutex};
+        mNumChunks = numChunks;
+        mReady.notify_all();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard lock{mMutex};
+            mClosed = true;
+        }
+        mNotFull.notify_all();
+        mReady.notify_all();
+    }
+
+private:
+    const std::size_t mCapacity;
+    std::mutex mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mReady;
+    std::map<std::size_t, T> mItems;
+    std::size_t mNext{0};
+    std::optional<std::size_t> mNumChunks;
+    bool mClosed{false};
+};
+
+template <typename Map, typename Sink, typename R, typename... Args>
+void parallel_for_each_impl(duckdb::QueryResult& result,
+                            Map& map,
+                            Sink& sink,
+                            std::size_t nthreads,
+                            std::function<R(Args...)>*)
+{
+    static_assert(!std::is_void_v<R>, "The map function must return a value");
+
+    // Returned references are copied, they may refer to the reused row values.
+    using Value = std::decay_t<R>;
+    static_assert(!is_zero_copy_v<Value>,
+                  "Mapped values are kept after their chunks are freed, use an owning type");
+
+    if constexpr (is_valid_signature<Args...>())
+    {
+        check_columns<Args...>(result);
+
+        struct Chunk
+        {
+            std::size_t seq;
+            std::size_t firstRow;
+            std::unique_ptr<duckdb::DataChunk> data;
+        };
+
+        nthreads = num_threads(nthreads);
+        BlockingQueue<Chunk> chunks{nthreads * 2};
+        ReorderBuffer<std::vector<Value>> outputs{nthreads * 2};
+
+        auto work = [&]
+        {
+            RowConverter<Args...> converter;
+            while (auto chunk{chunks.pop()})
+            {
+                std::vector<Value> values;
+                values.reserve(chunk->data->size());
+                auto mapRow = [&](auto&&... cols)
+                { values.push_back(map(std::forward<decltype(cols)>(cols)...)); };
+
+                converter.for_each_row(*chunk->data, chunk->firstRow, mapRow);
+                if (!outputs.push(chunk->seq, std::move(values)))
+                    break;
+            }
+        };
+
+        // The fetcher thread numbers the chunks, the workers map them and the sink thread
+        // consumes their results in order.
+        run_threads(
+            nthreads + 2,
+            [&](std::size_t idx)
+            {
+                if (idx < nthreads)
+                {
+                    work();
+                }
+                else if (idx == nthreads)
+                {
+                    std::size_t seq{0};
+                    std::size_t firstRow{0};
+                    while (auto data{result.Fetch()})
+                    {
+                        auto size{data->size()};
+                        if (!chunks.push({seq, firstRow, std::move(data)}))
+                            break;
+                        ++seq;
+                        firstRow += size;
+                    }
+                    chunks.close();
+                    check_stream_error(result);
+                    outputs.finish(seq);
+                }
+                else
+                {
+                    while (auto values{outputs.pop()})
+                    {
+                        for (auto& value : *values)
+                            sink(std::move(value));
+                    }
+                }
+            },
+            [&]
+            {
+                chunks.close();
+                outputs.close();
+            });
+    }
+}
+
+} // namespace details
+
+// Calls map(Args...) with each row on nthreads threads, 0 for one per core, and
+// sink(R&&) with the values returned by map in the result rows order, sink is called
+// from one thread at a time and it is returned at the end of the iteration. A map that
+// returns a reference has the referenced value copied.
+//
+// Chunks are converted and mapped in parallel and their values are reordered before the
+// sink, so that expensive map functions scale with the threads while the output stays
+// deterministic. The map function is called concurrently so it must not modify shared
+// data, memory is bounded by a few chunks per thread.
+template <typename Map, typename Sink>
+Sink parallel_for_each(std::unique_ptr<duckdb::QueryResult> result,
+                       Map map,
+                       Sink sink,
+                       std::size_t nthreads = 0)
+{
+    details::check_result(result);
 
-    return details::for_each_impl<F>(std::move(result), std::function{f});
+    using MapFunction = decltype(std::function{map});
+    details::parallel_for_each_impl(*result, map, sink, nthreads,
+                                    static_cast<MapFunction*>(nullptr));
+    return sink;
 }
 
 } // namespace duckforeach
@@ -0,0 +1,197 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+//
+// Replaces the global allocation functions so it runs as its own test executable.
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+// Allocations made by the current thread.
+thread_local std::size_t t_allocations{0};
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    ++t_allocations;
+    if (auto ptr{std::malloc(size ? size : 1)})
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace {
+
+// Counts the rows that allocated since the previous row of the same chunk, the first row
+// of each chunk is skipped as fetching and preparing a chunk allocates.
+struct AllocationCounter
+{
+    std::size_t numRows{0};
+    std::size_t allocatingRows{0};
+    std::size_t last{0};
+
+    void next()
+    {
+        if (numRows++ % STANDARD_VECTOR_SIZE != 0 && t_allocations != last)
+            ++allocatingRows;
+        last = t_allocations;
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test allocation free iteration")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{20'000};
+
+    // Strings have all the same size so that their capacity is reached on the first row.
+    auto res{con.Query(std::format(
+        "CREATE TABLE t AS SELECT i AS ival, i::INTEGER AS i32, i / 2 AS rval, i % 2 = 0 "
+        "AS bval, CASE WHEN i % 3 = 0 THEN NULL ELSE i END AS nval, "
+        "'a string longer than the inline size ' || lpad(i::VARCHAR, 5, '0') AS sval, "
+        "DATE '2024-06-01' + (i % 28)::INTEGER AS dval, "
+        "TIMESTAMP '2024-06-01' + INTERVAL (i) SECOND AS tsval, (i % 100)::TINYINT AS i8, "
+        "i::SMALLINT AS i16, (i % 200)::UTINYINT AS u8, i::USMALLINT AS u16, i::UINTEGER AS "
+        "u32, i::UBIGINT AS u64, (i / 4)::FLOAT AS fval, TIME '00:00:00' + INTERVAL (i) SECOND "
+        "AS tval, INTERVAL (i) MINUTE AS ivval FROM range({}) t(i)",
+        NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    SUBCASE("fixed width types")
+    {
+        AllocationCounter counter;
+        int64_t sum{0};
+        dfe::for_each(con.Query("select ival, i32, rval, bval, nval, dval, tsval, tsval from t"),
+                      [&](int64_t ival, int32_t i32, double rval, bool bval,
+                          std::optional<int64_t> nval, ddb::date_t, ddb::timestamp_t,
+                          dfe::Timestamp)
+                      {
+                          sum += ival + i32 + static_cast<int64_t>(rval) + bval + nval.value_or(0);
+                          counter.next();
+                      });
+
+        CHECK_EQ(counter.numRows, NUM_ROWS);
+        CHECK_EQ(counter.allocatingRows, 0);
+        CHECK_GT(sum, 0);
+
+        // Narrow, unsigned and float columns take the vectorized conversions.
+        counter = {};
+        sum = 0;
+        dfe::for_each(con.Query("select i8, i16, u8, u16, u32, u64, fval from t"),
+                      [&](int8_t i8, int16_t i16, uint8_t u8, uint16_t u16, uint32_t u32,
+                          uint64_t u64, float fval)
+                      {
+                          sum += i8 + i16 + u8 + u16 + u32 + static_cast<int64_t>(u64 + fval);
+                          counter.next();
+                      });
+
+        CHECK_EQ(counter.numRows, NUM_ROWS);
+        CHECK_EQ(counter.allocatingRows, 0);
+        CHECK_GT(sum, 0);
+
+        // Time types, including the converted calendar types.
+        counter = {};
+        int64_t seconds{0};
+        dfe::for_each(con.Query("select tval, ivval, dval, tval from t"),
+                      [&](ddb::dtime_t tval, ddb::interval_t ivval, dfe::year_month_day ymd,
+                          dfe::hh_mm_ss hms)
+                      {
+                          seconds += tval.micros / 1'000'000 + ivval.micros / 1'000'000 +
+                                     static_cast<unsigned>(ymd.day()) + hms.seconds().count();
+                          counter.next();
+                      });
+
+        CHECK_EQ(counter.numRows, NUM_ROWS);
+        CHECK_EQ(counter.allocatingRows, 0);
+        CHECK_GT(seconds, 0);
+    }
+
+    SUBCASE("string_view and string references")
+    {
+        AllocationCounter counter;
+        std::size_t totalSize{0};
+        dfe::for_each(con.Query("select sval, sval, sval from t"),
+                      [&](std::string_view view, const std::string& str,
+                          std::optional<std::string_view> optView)
+                      {
+                          CHECK_EQ(view, str);
+                          totalSize += view.size() + optView->size();
+                          counter.next();
+                      });
+
+        CHECK_EQ(counter.numRows, NUM_ROWS);
+        CHECK_EQ(counter.allocatingRows, 0);
+        CHECK_GT(totalSize, 0);
+    }
+
+    SUBCASE("string values")
+    {
+        // Strings taken by value are moved out of the row so they allocate.
+        std::size_t numRows{0};
+        dfe::for_each(con.Query("select sval, sval from t order by ival"),
+                      [&](std::string str, std::string&& moved)
+                      {
+                          CHECK_EQ(str, std::format("a string longer than the inline size {:05}",
+                                                    numRows));
+                          CHECK_EQ(moved, str);
+                          ++numRows;
+                      });
+        CHECK_EQ(numRows, NUM_ROWS);
+    }
+
+    SUBCASE("merged rows")
+    {
+        // Rows are swapped out of the converters, so only chunk changes allocate.
+        std::vector<std::unique_ptr<ddb::QueryResult>> results;
+        results.push_back(con.Query("select ival, sval from t where ival % 2 = 0 order by 1"));
+        results.push_back(con.Query("select ival, sval from t where ival % 2 = 1 order by 1"));
+
+        std::size_t numRows{0}, allocatingRows{0}, last{0};
+        dfe::merge_for_each(0, std::move(results),
+                            [&](std::size_t, int64_t, const std::string& sval)
+                            {
+                                CHECK_FALSE(sval.empty());
+                                if (numRows++ > 0 && t_allocations != last)
+                                    ++allocatingRows;
+                                last = t_allocations;
+                            });
+
+        CHECK_EQ(numRows, NUM_ROWS);
+        CHECK_LT(allocatingRows, NUM_ROWS / 100);
+    }
+
+    SUBCASE("string_view conversion errors")
+    {
+        CHECK_THROWS_AS(dfe::for_each(con.Query("select ival from t"), [](std::string_view) {}),
+                        std::invalid_argument);
+        CHECK_THROWS_AS(dfe::for_each(con.Query("select null::VARCHAR"), [](std::string_view) {}),
+                        std::invalid_argument);
+        dfe::for_each(con.Query("select null::VARCHAR"),
+                      [](std::optional<std::string_view> view) { CHECK_FALSE(view); });
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <string_view>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+TEST_CASE("Test arrow export")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    auto res{con.Query("CREATE TABLE t (ival BIGINT, rval DOUBLE, sval VARCHAR)")};
+    REQUIRE_FALSE(res->HasError());
+
+    // Use more rows than a chunk to get multiple arrays.
+    constexpr size_t NUM_ROWS{5000};
+
+    ddb::Appender appender{con, "t"};
+    for (size_t i{0}; i < NUM_ROWS; ++i)
+    {
+        auto label{std::format("label{}", i)};
+        appender.AppendRow(static_cast<int64_t>(i), i * 0.5, label.c_str());
+    }
+    appender.Close();
+
+    SUBCASE("schema and arrays")
+    {
+        size_t num_rows{0}, num_arrays{0};
+        CHECK_NOTHROW(dfe::for_each_arrow(
+            con.Query("select ival, rval, sval from t order by ival"),
+            [&](ArrowArray& array, ArrowSchema& schema)
+            {
+                REQUIRE_EQ(schema.n_children, 3);
+                CHECK_EQ(std::string_view{schema.children[0]->format}, "l");
+                CHECK_EQ(std::string_view{schema.children[1]->format}, "g");
+                CHECK_EQ(std::string_view{schema.children[2]->format}, "u");
+                CHECK_EQ(std::string_view{schema.children[0]->name}, "ival");
+
+                REQUIRE_EQ(array.n_children, 3);
+                CHECK_EQ(array.children[0]->null_count, 0);
+
+                auto ivals{static_cast<const int64_t*>(array.children[0]->buffers[1])};
+                auto rvals{static_cast<const double*>(array.children[1]->buffers[1])};
+                for (int64_t i{0}; i < array.length; ++i)
+                {
+                    CHECK_EQ(ivals[i], num_rows);
+                    CHECK_EQ(rvals[i], num_rows * 0.5);
+                    ++num_rows;
+                }
+
+                ++num_arrays;
+            }));
+
+        CHECK_EQ(num_rows, NUM_ROWS);
+        CHECK_GT(num_arrays, 1);
+    }
+
+    SUBCASE("move arrays out")
+    {
+        std::vector<ArrowArray> arrays;
+        CHECK_NOTHROW(dfe::for_each_arrow(con.Query("select sval from t order by ival"),
+                                          [&](ArrowArray& array, ArrowSchema&)
+                                          {
+                                              arrays.push_back(array);
+                                              array.release = nullptr;
+                                          }));
+
+        int64_t num_rows{0};
+        for (auto& array : arrays)
+        {
+            REQUIRE(array.release);
+            auto strs{array.children[0]};
+            auto offsets{static_cast<const int32_t*>(strs->buffers[1])};
+            auto data{static_cast<const char*>(strs->buffers[2])};
+            std::string_view first{data + offsets[0],
+                                   static_cast<size_t>(offsets[1] - offsets[0])};
+            CHECK_EQ(first, std::format("label{}", num_rows));
+
+            num_rows += array.length;
+            array.release(&array);
+        }
+
+        CHECK_EQ(num_rows, NUM_ROWS);
+    }
+
+    SUBCASE("null values")
+    {
+        REQUIRE_FALSE(con.Query("INSERT INTO t VALUES (null, null, null)")->HasError());
+
+        int64_t num_nulls{0};
+        CHECK_NOTHROW(dfe::for_each_arrow(con.Query("select ival from t"),
+                                          [&](ArrowArray& array, ArrowSchema&)
+                                          { num_nulls += array.children[0]->null_count; }));
+        CHECK_EQ(num_nulls, 1);
+    }
+
+    SUBCASE("throw on invalid result")
+    {
+        CHECK_THROWS(dfe::for_each_arrow(nullptr, [](ArrowArray&, ArrowSchema&) {}));
+        CHECK_THROWS(dfe::for_each_arrow(con.Query("select * from notable"),
+                                         [](ArrowArray&, ArrowSchema&) {}));
+    }
+}
@@ -0,0 +1,163 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+std::vector<std::byte> to_bytes(std::initializer_list<uint8_t> values)
+{
+    std::vector<std::byte> bytes;
+    for (auto v : values)
+        bytes.push_back(std::byte{v});
+    return bytes;
+}
+
+bool equal_bytes(std::span<const std::byte> lhs, const std::vector<std::byte>& rhs)
+{
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
+}
+
+} // namespace
+
+TEST_CASE("Test blobs")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    auto res{con.Query("CREATE TABLE t (id INTEGER, bval BLOB, sval VARCHAR)")};
+    REQUIRE_FALSE(res->HasError());
+
+    REQUIRE_FALSE(con.Query("INSERT INTO t VALUES "
+                            "(1, '\\x00\\x01\\xFF'::BLOB, 'a'), "
+                            "(2, ''::BLOB, 'bcd'), "
+                            "(3, 'protobuf\\x00\\x08\\x96\\x01'::BLOB, 'a long string value')")
+                      ->HasError());
+
+    const std::vector<std::vector<std::byte>> blobs{
+        to_bytes({0x00, 0x01, 0xFF}),
+        to_bytes({}),
+        to_bytes({'p', 'r', 'o', 't', 'o', 'b', 'u', 'f', 0x00, 0x08, 0x96, 0x01}),
+    };
+
+    SUBCASE("blob as byte span")
+    {
+        size_t num_rows{0};
+        CHECK_NOTHROW(dfe::for_each(con.Query("select id, bval from t order by id"),
+                                    [&](int32_t id, std::span<const std::byte> bytes)
+                                    {
+                                        CHECK(equal_bytes(bytes, blobs[id - 1]));
+                                        ++num_rows;
+                                    }));
+        CHECK_EQ(num_rows, blobs.size());
+    }
+
+    SUBCASE("string as byte span")
+    {
+        CHECK_NOTHROW(dfe::for_each(con.Query("select sval from t where id = 3"),
+                                    [&](const std::span<const std::byte>& bytes)
+                                    {
+                                        std::string_view sv{
+                                            reinterpret_cast<const char*>(bytes.data()),
+                                            bytes.size()};
+                                        CHECK_EQ(sv, "a long string value");
+                                    }));
+    }
+
+    SUBCASE("handle nulls using optional parameters")
+    {
+        REQUIRE_FALSE(con.Query("INSERT INTO t VALUES (4, null, null)")->HasError());
+
+        // This should throw as plain spans cannot handle nulls.
+        CHECK_THROWS(
+            dfe::for_each(con.Query("select bval from t"), [](std::span<const std::byte>) {}));
+
+        size_t num_nulls{0}, num_rows{0};
+        CHECK_NOTHROW(dfe::for_each(con.Query("select bval from t"),
+                                    [&](std::optional<std::span<const std::byte>> bytes)
+                                    {
+                                        if (bytes)
+                                            ++num_rows;
+                                        else
+                                            ++num_nulls;
+                                    }));
+        CHECK_EQ(num_rows, blobs.size());
+        CHECK_EQ(num_nulls, 1);
+    }
+
+    SUBCASE("throw on non binary columns")
+    {
+        CHECK_THROWS_AS(
+            dfe::for_each(con.Query("select id from t"), [](std::span<const std::byte>) {}),
+            std::invalid_argument);
+        CHECK_THROWS_AS(dfe::for_each(con.Query("select bval from t"), [](dfe::BitView) {}),
+                        std::invalid_argument);
+    }
+}
+
+TEST_CASE("Test bits")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    auto res{con.Query("CREATE TABLE t (id INTEGER, bits BIT)")};
+    REQUIRE_FALSE(res->HasError());
+
+    const std::vector<std::string> bitstrs{
+        "1",
+        "0110",
+        "10000001",
+        "101100111000111100001",
+    };
+
+    for (size_t i{0}; i < bitstrs.size(); ++i)
+    {
+        auto stm{std::format("INSERT INTO t VALUES ({}, '{}'::BIT)", i, bitstrs[i])};
+        REQUIRE_FALSE(con.Query(stm)->HasError());
+    }
+
+    SUBCASE("bits as BitView")
+    {
+        size_t num_rows{0};
+        CHECK_NOTHROW(dfe::for_each(con.Query("select id, bits from t order by id"),
+                                    [&](int32_t id, dfe::BitView bits)
+                                    {
+                                        const auto& expected{bitstrs[id]};
+                                        CHECK_EQ(bits.size(), expected.size());
+                                        CHECK_EQ(bits.to_string(), expected);
+                                        CHECK_EQ(bits.count(), std::count(expected.begin(),
+                                                                          expected.end(), '1'));
+                                        for (size_t i{0}; i < expected.size(); ++i)
+                                            CHECK_EQ(bits.test(i), expected[i] == '1');
+                                        CHECK_THROWS_AS(bits.test(expected.size()),
+                                                        std::out_of_range);
+                                        ++num_rows;
+                                    }));
+        CHECK_EQ(num_rows, bitstrs.size());
+    }
+
+    SUBCASE("handle nulls using optional parameters")
+    {
+        REQUIRE_FALSE(con.Query("INSERT INTO t VALUES (10, null)")->HasError());
+
+        CHECK_THROWS(dfe::for_each(con.Query("select bits from t"), [](dfe::BitView) {}));
+
+        size_t num_nulls{0};
+        CHECK_NOTHROW(dfe::for_each(con.Query("select bits from t"),
+                                    [&](std::optional<dfe::BitView> bits)
+                                    {
+                                        if (!bits)
+                                            ++num_nulls;
+                                    }));
+        CHECK_EQ(num_nulls, 1);
+    }
+}
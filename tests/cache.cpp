@@ -0,0 +1,254 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <filesystem>
+#include <stdexcept>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Summer
+{
+    int64_t sum{0};
+    std::size_t num_rows{0};
+    std::size_t num_nulls{0};
+
+    void operator()(std::optional<int64_t> ival, std::string sval)
+    {
+        CHECK_EQ(sval, std::format("label {}", ival.value_or(-1)));
+        if (ival)
+            sum += *ival;
+        else
+            ++num_nulls;
+        ++num_rows;
+    }
+};
+
+// A cache directory removed at the end of the test.
+struct TempDir
+{
+    fs::path path{fs::temp_directory_path() /
+                  std::format("dfe_cache_{}", std::hash<std::thread::id>{}(
+                                                   std::this_thread::get_id()))};
+
+    TempDir()
+    {
+        fs::remove_all(path);
+    }
+
+    ~TempDir()
+    {
+        fs::remove_all(path);
+    }
+
+    std::size_t num_files() const
+    {
+        return std::distance(fs::directory_iterator{path}, fs::directory_iterator{});
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test cached for_each")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{5000};
+    constexpr int64_t SUM{NUM_ROWS * (NUM_ROWS - 1) / 2};
+
+    auto res{con.Query(std::format("CREATE TABLE t AS "
+                                   "SELECT i AS ival, 'label ' || i AS sval "
+                                   "FROM range({}) t(i)",
+                                   NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+    REQUIRE_FALSE(con.Query("INSERT INTO t VALUES (null, 'label -1')")->HasError());
+
+    TempDir cache;
+    const std::string query{"select ival, sval from t"};
+
+    auto first{dfe::cached_for_each(con, query, Summer{}, cache.path)};
+    CHECK_EQ(first.sum, SUM);
+    CHECK_EQ(first.num_rows, NUM_ROWS + 1);
+    CHECK_EQ(first.num_nulls, 1);
+    CHECK_EQ(cache.num_files(), 1);
+
+    // Later calls don't see the table changes.
+    REQUIRE_FALSE(con.Query("DELETE FROM t WHERE ival >= 10")->HasError());
+
+    SUBCASE("cached result")
+    {
+        auto cached{dfe::cached_for_each(con, query, Summer{}, cache.path)};
+        CHECK_EQ(cached.sum, SUM);
+        CHECK_EQ(cached.num_rows, NUM_ROWS + 1);
+        CHECK_EQ(cached.num_nulls, 1);
+    }
+
+    SUBCASE("version change")
+    {
+        auto updated{dfe::cached_for_each(con, query, Summer{}, cache.path, {.version = "v2"})};
+        CHECK_EQ(updated.sum, 45);
+        CHECK_EQ(dfe::cached_for_each(con, query, Summer{}, cache.path, {.version = "v2"}).sum,
+                 45);
+        CHECK_EQ(cache.num_files(), 1);
+    }
+
+    SUBCASE("expired entry")
+    {
+        using namespace std::chrono_literals;
+
+        CHECK_EQ(dfe::cached_for_each(con, query, Summer{}, cache.path, {.ttl = 1h}).sum, SUM);
+
+        for (auto& entry : fs::directory_iterator{cache.path})
+            fs::last_write_time(entry.path(), fs::file_time_type::clock::now() - 2h);
+
+        CHECK_EQ(dfe::cached_for_each(con, query, Summer{}, cache.path, {.ttl = 1h}).sum, 45);
+    }
+
+    SUBCASE("query parameters")
+    {
+        const std::string paramQuery{"select ival, sval from t where ival < ?"};
+
+        CHECK_EQ(dfe::cached_for_each(con, paramQuery, Summer{}, cache.path,
+                                      {.parameters = {ddb::Value::BIGINT(5)}})
+                     .sum,
+                 10);
+        CHECK_EQ(dfe::cached_for_each(con, paramQuery, Summer{}, cache.path,
+                                      {.parameters = {ddb::Value::BIGINT(3)}})
+                     .sum,
+                 3);
+        CHECK_EQ(cache.num_files(), 3);
+    }
+
+    SUBCASE("corrupted entry")
+    {
+        for (auto& entry : fs::directory_iterator{cache.path})
+            fs::resize_file(entry.path(), fs::file_size(entry.path()) / 2);
+
+        CHECK_EQ(dfe::cached_for_each(con, query, Summer{}, cache.path).sum, 45);
+    }
+
+    SUBCASE("errors")
+    {
+        CHECK_THROWS_AS(dfe::cached_for_each(con, "select * from notable", Summer{}, cache.path),
+                        std::runtime_error);
+        CHECK_THROWS_AS(dfe::cached_for_each(con, query, [](int64_t) {}, cache.path),
+                        std::invalid_argument);
+        CHECK_EQ(cache.num_files(), 1);
+    }
+}
+
+TEST_CASE("Test result cache")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{5000};
+    constexpr int64_t SUM{NUM_ROWS * (NUM_ROWS - 1) / 2};
+
+    auto res{con.Query(std::format("CREATE TABLE t AS "
+                                   "SELECT i AS ival, 'label ' || i AS sval "
+                                   "FROM range({}) t(i)",
+                                   NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    const std::string query{"select ival, sval from t"};
+
+    SUBCASE("cached results")
+    {
+        dfe::ResultCache cache{1 << 20};
+
+        CHECK_EQ(cache.for_each(con, query, Summer{}).sum, SUM);
+        CHECK_EQ(cache.size(), 1);
+        CHECK_GT(cache.bytes(), NUM_ROWS * sizeof(int64_t));
+
+        REQUIRE_FALSE(con.Query("DELETE FROM t WHERE ival >= 10")->HasError());
+        CHECK_EQ(cache.for_each(con, query, Summer{}).sum, SUM);
+
+        cache.erase(query);
+        CHECK_EQ(cache.size(), 0);
+        CHECK_EQ(cache.bytes(), 0);
+        CHECK_EQ(cache.for_each(con, query, Summer{}).sum, 45);
+    }
+
+    SUBCASE("least recently used eviction")
+    {
+        auto query_n = [](int n)
+        { return std::format("select ival, sval from t where ival < {}", n); };
+
+        // Find the size of an entry.
+        dfe::ResultCache sizer{1 << 20};
+        sizer.for_each(con, query_n(1000), Summer{});
+        auto entryBytes{sizer.bytes()};
+
+        dfe::ResultCache cache{entryBytes * 2 + entryBytes / 2};
+        cache.for_each(con, query_n(1000), Summer{});
+        cache.for_each(con, query_n(1001), Summer{});
+        cache.for_each(con, query_n(1000), Summer{});
+        CHECK_EQ(cache.size(), 2);
+
+        // Evicts the 1001 entry that is the least recently used.
+        cache.for_each(con, query_n(1002), Summer{});
+        CHECK_EQ(cache.size(), 2);
+        CHECK_LE(cache.bytes(), entryBytes * 2 + entryBytes / 2);
+
+        REQUIRE_FALSE(con.Query("DELETE FROM t WHERE ival >= 10")->HasError());
+        CHECK_EQ(cache.for_each(con, query_n(1000), Summer{}).num_rows, 1000);
+        CHECK_EQ(cache.for_each(con, query_n(1002), Summer{}).num_rows, 1002);
+        CHECK_EQ(cache.for_each(con, query_n(1001), Summer{}).num_rows, 10);
+
+        // Results larger than the cache are not stored.
+        dfe::ResultCache small{100};
+        CHECK_EQ(small.for_each(con, query, Summer{}).sum, 45);
+        CHECK_EQ(small.size(), 0);
+        CHECK_EQ(small.bytes(), 0);
+
+        cache.clear();
+        CHECK_EQ(cache.size(), 0);
+        CHECK_EQ(cache.bytes(), 0);
+    }
+
+    SUBCASE("concurrent readers")
+    {
+        dfe::ResultCache cache{1 << 20};
+
+        std::atomic<std::size_t> numErrors{0};
+        std::vector<std::thread> threads;
+        for (int i{0}; i < 4; ++i)
+        {
+            threads.emplace_back(
+                [&, i]
+                {
+                    ddb::Connection threadCon{db};
+                    for (int n{0}; n < 20; ++n)
+                    {
+                        auto sql{n % 2 ? query : std::format("{} where ival < {}", query, i)};
+                        auto summer{cache.for_each(threadCon, sql, Summer{})};
+                        if (summer.sum != (n % 2 ? SUM : i * (i - 1) / 2))
+                            ++numErrors;
+                    }
+                });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        CHECK_EQ(numErrors, 0);
+        CHECK_EQ(cache.size(), 5);
+    }
+
+    SUBCASE("errors")
+    {
+        dfe::ResultCache cache{1 << 20};
+        CHECK_THROWS_AS(cache.for_each(con, "select * from notable", Summer{}),
+                        std::runtime_error);
+        CHECK_THROWS_AS(cache.for_each(con, query, [](int64_t) {}), std::invalid_argument);
+        CHECK_EQ(cache.size(), 1);
+    }
+}
@@ -0,0 +1,140 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+struct Totals
+{
+    int64_t count{0};
+    int64_t sum{0};
+    int64_t failAt{-1};
+
+    void operator()(int64_t id, dfe::Timestamp, int64_t volume)
+    {
+        if (id == failAt)
+            throw std::runtime_error{"failure"};
+
+        ++count;
+        sum += volume;
+    }
+
+    std::string serialize() const
+    {
+        return std::format("{} {}", count, sum);
+    }
+
+    static Totals deserialize(const std::string& state)
+    {
+        Totals totals;
+        std::istringstream is{state};
+        is >> totals.count >> totals.sum;
+        return totals;
+    }
+};
+
+// A checkpoint as it would be saved to a file.
+struct Saved
+{
+    std::string key;
+    std::string state;
+};
+
+} // namespace
+
+TEST_CASE("Test checkpointed iteration")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{50'000};
+
+    auto res{con.Query(std::format("CREATE TABLE trades AS SELECT i AS id, "
+                                   "TIMESTAMP '2024-06-01' + INTERVAL (i) SECOND AS ts, "
+                                   "i % 100 AS volume FROM range({}) t(i)",
+                                   NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    const std::string query{"select id, ts, volume from trades order by ts"};
+
+    auto expected{dfe::for_each(con.Query(query), Totals{})};
+    REQUIRE_EQ(expected.count, NUM_ROWS);
+
+    std::optional<Saved> saved;
+    std::size_t numCheckpoints{0};
+    auto save = [&](const ddb::Value& key, const Totals& totals)
+    {
+        saved = Saved{key.ToString(), totals.serialize()};
+        ++numCheckpoints;
+    };
+
+    SUBCASE("complete run")
+    {
+        auto totals{dfe::for_each_checkpointed(con, query, "ts", Totals{}, save,
+                                               {.interval_rows = 10'000})};
+
+        CHECK_EQ(totals.count, expected.count);
+        CHECK_EQ(totals.sum, expected.sum);
+
+        // Every 5 chunks and the last rows.
+        CHECK_EQ(numCheckpoints, NUM_ROWS / (5 * STANDARD_VECTOR_SIZE) + 1);
+        REQUIRE(saved);
+        CHECK_EQ(saved->key, "2024-06-01 13:53:19");
+        CHECK_EQ(saved->state, totals.serialize());
+    }
+
+    SUBCASE("resume after a failure")
+    {
+        CHECK_THROWS_AS(dfe::for_each_checkpointed(con, query, "ts", Totals{.failAt = 30'000},
+                                                   save, {.interval_rows = 4096}),
+                        std::runtime_error);
+        REQUIRE(saved);
+
+        auto resumed{Totals::deserialize(saved->state)};
+        CHECK_LT(resumed.count, 30'000);
+        CHECK_GE(resumed.count, 30'000 - 4096);
+
+        auto totals{dfe::for_each_checkpointed(
+            con, query, "ts", resumed, save,
+            {.resume_after = ddb::Value{saved->key}.DefaultCastAs(ddb::LogicalType::TIMESTAMP),
+             .interval_rows = 4096})};
+
+        CHECK_EQ(totals.count, expected.count);
+        CHECK_EQ(totals.sum, expected.sum);
+    }
+
+    SUBCASE("resume after the last row")
+    {
+        auto totals{dfe::for_each_checkpointed(con, query, "id", Totals{}, save,
+                                               {.resume_after = ddb::Value::BIGINT(NUM_ROWS)})};
+        CHECK_EQ(totals.count, 0);
+        CHECK_EQ(numCheckpoints, 0);
+    }
+
+    SUBCASE("errors")
+    {
+        CHECK_THROWS_AS(dfe::for_each_checkpointed(con, query, "nocolumn", Totals{}, save),
+                        std::invalid_argument);
+        CHECK_THROWS_AS(
+            dfe::for_each_checkpointed(con, query, "ts", Totals{}, save, {.interval_rows = 0}),
+            std::invalid_argument);
+        CHECK_THROWS_AS(dfe::for_each_checkpointed(
+                            con, "select id, null::TIMESTAMP as ts, volume from trades", "ts",
+                            Totals{}, save),
+                        std::invalid_argument);
+        CHECK_THROWS_AS(dfe::for_each_checkpointed(con, "select * from notable", "ts", Totals{},
+                                                   save, {.resume_after = ddb::Value{"x"}}),
+                        std::runtime_error);
+    }
+}
@@ -0,0 +1,171 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+// Converts all values to strings like a generic exporter would do.
+struct ToStrings
+{
+    std::vector<std::vector<std::string>> rows;
+    std::vector<std::string> types;
+
+    template <typename T> void operator()(const dfe::ColumnView<T>& column)
+    {
+        if (rows.size() < column.first_row() + column.size())
+            rows.resize(column.first_row() + column.size());
+
+        if (column.first_row() == 0)
+            types.push_back(column.type().ToString());
+
+        for (size_t row{0}; row < column.size(); ++row)
+        {
+            auto& out{rows[column.first_row() + row]};
+            if (column.is_null(row))
+                out.push_back("NULL");
+            else if constexpr (std::is_same_v<T, ddb::Value>)
+                out.push_back(column[row].ToString());
+            else if constexpr (std::is_same_v<T, ddb::string_t>)
+                out.push_back(std::string{column[row]});
+            else if constexpr (std::is_arithmetic_v<T>)
+                out.push_back(std::format("{}", column[row]));
+            else
+                out.push_back(ddb::Value::CreateValue(column[row]).ToString());
+        }
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test dynamic visitor")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    auto res{con.Query("CREATE TABLE t ("
+                       "  ival INTEGER, "
+                       "  uval UBIGINT, "
+                       "  rval DOUBLE, "
+                       "  sval VARCHAR, "
+                       "  dtval DATE, "
+                       "  tsval TIMESTAMP, "
+                       "  dval DECIMAL(10, 2), "
+                       "  lval INTEGER[])")};
+    REQUIRE_FALSE(res->HasError());
+
+    constexpr size_t NUM_ROWS{3000};
+    auto stm{std::format("INSERT INTO t SELECT "
+                         "i, i, i + 0.5, 'label' || i, DATE '2024-06-01' + (i % 28)::INTEGER, "
+                         "TIMESTAMP '2024-06-01 11:30:00' + INTERVAL (i) MINUTE, i + 0.25, [i, 1] "
+                         "FROM range({}) t(i)",
+                         NUM_ROWS)};
+    REQUIRE_FALSE(con.Query(stm)->HasError());
+    REQUIRE_FALSE(
+        con.Query("INSERT INTO t VALUES (null, null, null, null, null, null, null, null)")
+            ->HasError());
+
+    SUBCASE("typed columns")
+    {
+        size_t num_chunks{0};
+        std::vector<std::string> names;
+
+        dfe::for_each_dynamic(con.Query("select * from t"),
+                              [&](const auto& column)
+                              {
+                                  using View = std::decay_t<decltype(column)>;
+
+                                  if (column.first_row() == 0)
+                                      names.push_back(column.name());
+                                  if (column.index() == 0)
+                                      ++num_chunks;
+
+                                  switch (column.index())
+                                  {
+                                  case 0:
+                                      CHECK(std::is_same_v<View, dfe::ColumnView<int32_t>>);
+                                      break;
+                                  case 1:
+                                      CHECK(std::is_same_v<View, dfe::ColumnView<uint64_t>>);
+                                      break;
+                                  case 2:
+                                      CHECK(std::is_same_v<View, dfe::ColumnView<double>>);
+                                      break;
+                                  case 3:
+                                      CHECK(std::is_same_v<View, dfe::ColumnView<ddb::string_t>>);
+                                      break;
+                                  case 4:
+                                      CHECK(std::is_same_v<View, dfe::ColumnView<ddb::date_t>>);
+                                      break;
+                                  case 5:
+                                      CHECK(std::is_same_v<View,
+                                                           dfe::ColumnView<ddb::timestamp_t>>);
+                                      break;
+                                  default:
+                                      CHECK(std::is_same_v<View, dfe::ColumnView<ddb::Value>>);
+                                  }
+                              });
+
+        CHECK_EQ(names, std::vector<std::string>{"ival", "uval", "rval", "sval", "dtval", "tsval",
+                                                 "dval", "lval"});
+        CHECK_GT(num_chunks, 1);
+    }
+
+    SUBCASE("typed spans")
+    {
+        int64_t sum{0};
+        size_t num_nulls{0};
+
+        dfe::for_each_dynamic(con.Query("select ival from t"),
+                              [&]<typename T>(const dfe::ColumnView<T>& column)
+                              {
+                                  if constexpr (std::is_same_v<T, int32_t>)
+                                  {
+                                      auto values{column.values()};
+                                      for (size_t row{0}; row < values.size(); ++row)
+                                      {
+                                          if (column.is_null(row))
+                                              ++num_nulls;
+                                          else
+                                              sum += values[row];
+                                      }
+                                  }
+                              });
+
+        CHECK_EQ(sum, NUM_ROWS * (NUM_ROWS - 1) / 2);
+        CHECK_EQ(num_nulls, 1);
+    }
+
+    SUBCASE("matches value conversion")
+    {
+        auto strs{dfe::for_each_dynamic(con.Query("select * from t order by ival nulls last"),
+                                        ToStrings{})};
+        REQUIRE_EQ(strs.rows.size(), NUM_ROWS + 1);
+
+        size_t row{0};
+        auto expected{con.Query("select * from t order by ival nulls last")};
+        for (auto& dbRow : *expected)
+        {
+            for (size_t col{0}; col < expected->ColumnCount(); ++col)
+            {
+                auto value{dbRow.iterator.chunk->GetValue(col, dbRow.row)};
+                CHECK_EQ(strs.rows[row][col], value.IsNull() ? "NULL" : value.ToString());
+            }
+            ++row;
+        }
+    }
+
+    SUBCASE("throw on invalid result")
+    {
+        CHECK_THROWS(dfe::for_each_dynamic(nullptr, ToStrings{}));
+        CHECK_THROWS(dfe::for_each_dynamic(con.Query("select * from notable"), ToStrings{}));
+    }
+}
@@ -0,0 +1,108 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct DayTotals
+{
+    fs::path path;
+    std::size_t count{0};
+    double volume{0};
+
+    void operator()(std::string file, std::string, double close, int64_t volume)
+    {
+        CHECK_EQ(file, path.string());
+        CHECK_GT(close, 0);
+        ++count;
+        this->volume += volume;
+    }
+};
+
+// Daily database files with one prices table each.
+struct DayFiles
+{
+    fs::path dir{fs::temp_directory_path() /
+                 std::format("dfe_files_{}",
+                             std::hash<std::thread::id>{}(std::this_thread::get_id()))};
+    std::vector<fs::path> paths;
+
+    explicit DayFiles(int numDays)
+    {
+        fs::remove_all(dir);
+        fs::create_directories(dir);
+
+        for (int day{0}; day < numDays; ++day)
+        {
+            paths.push_back(dir / std::format("day{}'s.db", day));
+
+            ddb::DuckDB db{paths.back().string()};
+            ddb::Connection con{db};
+            auto res{con.Query(std::format("CREATE TABLE prices AS "
+                                           "SELECT 'SYM' || (i % 10) AS symbol, "
+                                           "1.0 + i AS close, {} AS volume "
+                                           "FROM range({}) t(i)",
+                                           day, 1000 + day * 100))};
+            REQUIRE_FALSE(res->HasError());
+        }
+    }
+
+    ~DayFiles()
+    {
+        fs::remove_all(dir);
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test for_each files")
+{
+    constexpr int NUM_DAYS{8};
+    DayFiles files{NUM_DAYS};
+
+    const std::string query{"select {}, symbol, close, volume from prices"};
+    auto makeTotals = [](const fs::path& path) { return DayTotals{path}; };
+
+    for (std::size_t nthreads : {1, 3, 0})
+    {
+        CAPTURE(nthreads);
+
+        auto totals{dfe::for_each_files(files.paths, query, makeTotals, nthreads)};
+
+        REQUIRE_EQ(totals.size(), NUM_DAYS);
+        for (int day{0}; day < NUM_DAYS; ++day)
+        {
+            CHECK_EQ(totals[day].path, files.paths[day]);
+            CHECK_EQ(totals[day].count, 1000 + day * 100);
+            CHECK_EQ(totals[day].volume, day * totals[day].count);
+        }
+    }
+
+    SUBCASE("no files")
+    {
+        CHECK(dfe::for_each_files({}, query, makeTotals).empty());
+    }
+
+    SUBCASE("errors")
+    {
+        auto paths{files.paths};
+        paths.push_back(files.dir / "missing.db");
+        CHECK_THROWS_AS(dfe::for_each_files(paths, query, makeTotals, 2), std::runtime_error);
+
+        CHECK_THROWS_AS(dfe::for_each_files(files.paths, "select * from notable", makeTotals),
+                        std::runtime_error);
+        CHECK_THROWS_AS(dfe::for_each_files(files.paths, "select symbol from prices", makeTotals),
+                        std::invalid_argument);
+    }
+}
@@ -0,0 +1,127 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+namespace chr = std::chrono;
+
+namespace {
+
+struct Collector
+{
+    std::vector<int64_t> ids;
+
+    void operator()(int64_t id, std::string, dfe::Timestamp, std::optional<double>)
+    {
+        ids.push_back(id);
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test filtered scans")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{10'000};
+
+    auto res{con.Query(std::format("CREATE TABLE prices AS SELECT i AS id, "
+                                   "'SYM' || (i % 4) AS symbol, "
+                                   "TIMESTAMP '2024-06-01' + INTERVAL (i) SECOND AS ts, "
+                                   "CASE WHEN i % 10 = 0 THEN NULL ELSE i * 0.5 END AS close "
+                                   "FROM range({}) t(i)",
+                                   NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    dfe::TableScan prices{con, "prices", "id, symbol, ts, close"};
+
+    // Ids of the rows matching where, ordered as they are scanned.
+    auto expected = [&](std::string_view where)
+    {
+        std::vector<int64_t> ids;
+        dfe::for_each(con.Query(std::format("select id from prices where {}", where)),
+                      [&](int64_t id) { ids.push_back(id); });
+        REQUIRE_FALSE(ids.empty());
+        return ids;
+    };
+
+    SUBCASE("comparisons")
+    {
+        dfe::col<double> close{"close"};
+        dfe::col<std::string> symbol{"symbol"};
+
+        CHECK_EQ(prices.for_each(close > 4000.0, Collector{}).ids, expected("close > 4000"));
+        CHECK_EQ(prices.for_each(close <= 10, Collector{}).ids, expected("close <= 10"));
+        CHECK_EQ(prices.for_each(symbol == "SYM1", Collector{}).ids,
+                 expected("symbol = 'SYM1'"));
+        CHECK_EQ(prices.for_each(close >= 100.0 && symbol != "SYM1" && close < 200.0,
+                                 Collector{})
+                     .ids,
+                 expected("close >= 100 and symbol <> 'SYM1' and close < 200"));
+        CHECK_EQ(prices.for_each(close < 5.0 || !(close < 4990.0), Collector{}).ids,
+                 expected("close < 5 or not (close < 4990)"));
+    }
+
+    SUBCASE("nulls")
+    {
+        dfe::col<double> close{"close"};
+
+        CHECK_EQ(prices.for_each(close.is_null(), Collector{}).ids, expected("close is null"));
+        CHECK_EQ(prices.for_each(close.is_not_null() && dfe::col<int64_t>{"id"} < 20,
+                                 Collector{})
+                     .ids,
+                 expected("close is not null and id < 20"));
+    }
+
+    SUBCASE("time values")
+    {
+        dfe::Timestamp from{chr::sys_days{chr::year{2024} / 6 / 1} + chr::hours{1}};
+        dfe::Timestamp to{from.time() + chr::minutes{5}};
+
+        dfe::col<dfe::Timestamp> ts{"ts"};
+        CHECK_EQ(prices.for_each(ts >= from && ts < to, Collector{}).ids,
+                 expected("ts >= TIMESTAMP '2024-06-01 01:00:00' and "
+                          "ts < TIMESTAMP '2024-06-01 01:05:00'"));
+    }
+
+    SUBCASE("same shape filters share the SQL")
+    {
+        dfe::col<double> close{"close"};
+        dfe::col<std::string> symbol{"symbol"};
+
+        auto lhs{close > 1.0 && symbol == "SYM1"};
+        auto rhs{close > 2.0 && symbol == "SYM2"};
+        CHECK_EQ(lhs.sql(), R"((("close" > ?) AND ("symbol" = ?)))");
+        CHECK_EQ(lhs.sql(), rhs.sql());
+        CHECK_EQ(rhs.parameters().size(), 2);
+        CHECK_EQ(rhs.parameters()[1].ToString(), "SYM2");
+
+        // The cached statement is executed with the new values.
+        for (int64_t id : {10, 20, 30})
+        {
+            auto ids{prices.for_each(dfe::col<int64_t>{"id"} == id, Collector{}).ids};
+            CHECK_EQ(ids, std::vector<int64_t>{id});
+        }
+    }
+
+    SUBCASE("quoted names")
+    {
+        CHECK_EQ(dfe::col<int64_t>{"a \"b\""}.is_null().sql(), R"(("a ""b""" IS NULL))");
+    }
+
+    SUBCASE("errors")
+    {
+        CHECK_THROWS_AS(prices.for_each(dfe::col<double>{"nocolumn"} > 1.0, Collector{}),
+                        std::runtime_error);
+        CHECK_THROWS_AS(prices.for_each(dfe::col<int64_t>{"id"} > 1, [](int64_t) {}),
+                        std::invalid_argument);
+    }
+}
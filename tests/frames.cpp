@@ -0,0 +1,165 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+using Row = std::tuple<std::optional<int32_t>,
+                       std::optional<double>,
+                       std::optional<std::string>,
+                       std::optional<dfe::Timestamp>,
+                       std::optional<dfe::year_month_day>,
+                       std::optional<double>,
+                       std::optional<std::string>,
+                       std::optional<bool>>;
+
+struct RowCollector
+{
+    std::vector<Row> rows;
+
+    void operator()(std::optional<int32_t> ival,
+                    std::optional<double> rval,
+                    std::optional<std::string> sval,
+                    std::optional<dfe::Timestamp> tsval,
+                    std::optional<dfe::year_month_day> dtval,
+                    std::optional<double> dval,
+                    std::optional<std::string> hval,
+                    std::optional<bool> bval)
+    {
+        rows.emplace_back(ival, rval, sval, tsval, dtval, dval, hval, bval);
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test frame serialization")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{5000};
+
+    auto res{con.Query(std::format(
+        "CREATE TABLE t AS SELECT "
+        "i::INTEGER AS ival, i * 0.5 AS rval, "
+        "CASE WHEN i % 2 = 0 THEN 'short' || i ELSE 'a string longer than inline ' || i END "
+        "AS sval, TIMESTAMP '2024-06-01 11:30:00' + INTERVAL (i) SECOND AS tsval, "
+        "DATE '2024-06-01' + (i % 28)::INTEGER AS dtval, (i / 100)::DECIMAL(10, 2) AS dval, "
+        "i::HUGEINT AS hval, i % 3 = 0 AS bval "
+        "FROM range({}) t(i)",
+        NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+    REQUIRE_FALSE(
+        con.Query("INSERT INTO t VALUES (null, null, null, null, null, null, null, null)")
+            ->HasError());
+
+    const std::string query{"select * from t order by ival nulls last"};
+
+    SUBCASE("round trip")
+    {
+        auto expected{dfe::for_each(con.Query(query), RowCollector{})};
+        REQUIRE_EQ(expected.rows.size(), NUM_ROWS + 1);
+
+        std::stringstream ss;
+        CHECK_EQ(dfe::serialize(con.Query(query), ss), NUM_ROWS + 1);
+
+        auto rows{dfe::for_each_frame(ss, RowCollector{})};
+        CHECK(rows.rows == expected.rows);
+    }
+
+    SUBCASE("stream results and zero copy types")
+    {
+        std::stringstream ss;
+        CHECK_EQ(dfe::serialize(con.SendQuery("select sval::BLOB, '101'::BIT from t"), ss),
+                 NUM_ROWS + 1);
+
+        std::size_t numRows{0}, numNulls{0};
+        dfe::for_each_frame(ss,
+                            [&](std::optional<std::span<const std::byte>> blob, dfe::BitView bits)
+                            {
+                                if (!blob)
+                                    ++numNulls;
+                                CHECK_EQ(bits.to_string(), "101");
+                                ++numRows;
+                            });
+        CHECK_EQ(numRows, NUM_ROWS + 1);
+        CHECK_EQ(numNulls, 1);
+    }
+
+    SUBCASE("multiple results in a pipe")
+    {
+        int fds[2];
+        REQUIRE_EQ(pipe(fds), 0);
+
+        std::thread writer{[&]
+                           {
+                               dfe::serialize(con.Query("select ival from t"), fds[1]);
+                               dfe::serialize(con.Query("select 42 as ival"), fds[1]);
+                               close(fds[1]);
+                           }};
+
+        std::size_t numRows{0};
+        dfe::for_each_frame(fds[0], [&](std::optional<int64_t>) { ++numRows; });
+        CHECK_EQ(numRows, NUM_ROWS + 1);
+
+        int64_t last{0};
+        dfe::for_each_frame(fds[0], [&](int64_t ival) { last = ival; });
+        CHECK_EQ(last, 42);
+
+        writer.join();
+        close(fds[0]);
+    }
+
+    SUBCASE("conversion errors")
+    {
+        std::stringstream ss;
+        dfe::serialize(con.Query("select ival from t order by ival"), ss);
+
+        try
+        {
+            dfe::for_each_frame(ss, [](std::optional<int8_t>) {});
+            FAIL("overflow not detected");
+        }
+        catch (const std::invalid_argument& ex)
+        {
+            CHECK_EQ(std::string{ex.what()},
+                     "Cannot convert value 128 at column 1 row 129 of type INTEGER to int8");
+        }
+
+        ss.clear();
+        ss.seekg(0);
+        CHECK_THROWS_AS(dfe::for_each_frame(ss, [](int32_t, int32_t) {}), std::invalid_argument);
+    }
+
+    SUBCASE("errors")
+    {
+        std::stringstream ss;
+        CHECK_THROWS_AS(dfe::serialize(nullptr, ss), std::invalid_argument);
+        CHECK_THROWS_AS(dfe::serialize(con.Query("select * from notable"), ss),
+                        std::runtime_error);
+        CHECK_THROWS_AS(dfe::serialize(con.Query("select [1, 2]"), ss), std::invalid_argument);
+
+        // Truncated stream.
+        std::stringstream full;
+        dfe::serialize(con.Query(query), full);
+        auto data{full.str()};
+        std::stringstream truncated{data.substr(0, data.size() / 2)};
+        CHECK_THROWS_AS(dfe::for_each_frame(truncated, RowCollector{}), std::runtime_error);
+
+        // Invalid header.
+        data[4] = 'X';
+        std::stringstream invalid{data};
+        CHECK_THROWS_AS(dfe::for_each_frame(invalid, RowCollector{}), std::runtime_error);
+    }
+}
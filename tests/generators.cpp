@@ -0,0 +1,163 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+namespace chr = std::chrono;
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+using Row = std::tuple<int64_t, std::optional<std::string>, double, dfe::Timestamp>;
+
+// Produces count rows, every 7th label is NULL.
+struct RowGenerator
+{
+    int64_t count{0};
+    int64_t next{0};
+
+    std::optional<Row> operator()()
+    {
+        if (next == count)
+            return std::nullopt;
+
+        auto i{next++};
+        std::optional<std::string> label;
+        if (i % 7 != 0)
+            label = std::format("a label longer than inline {}", i);
+
+        dfe::Timestamp ts{dfe::Timestamp::TimeType{chr::seconds{1'717'200'000 + i}} +
+                          chr::nanoseconds{123}};
+        return Row{i, label, i * 0.5, ts};
+    }
+};
+
+// Counts how many rows the generator produced across all copies.
+struct CountingGenerator
+{
+    std::shared_ptr<int64_t> produced{std::make_shared<int64_t>(0)};
+    int64_t next{0};
+
+    std::optional<std::tuple<int64_t, std::string>> operator()()
+    {
+        if (next == 5000)
+            return std::nullopt;
+        ++*produced;
+        ++next;
+        return std::tuple{next, std::string{"label"}};
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test table functions")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{10'000};
+
+    SUBCASE("function object generator")
+    {
+        dfe::register_table_function<int64_t, std::optional<std::string>, double, dfe::Timestamp>(
+            con, "gen_rows", RowGenerator{NUM_ROWS}, {"id", "label", "price", "ts"});
+
+        int64_t expected{0};
+        dfe::for_each(con.Query("select id, label, price, ts from gen_rows()"),
+                      [&](int64_t id, std::optional<std::string> label, double price,
+                          dfe::Timestamp ts)
+                      {
+                          CHECK_EQ(id, expected);
+                          CHECK_EQ(label.has_value(), id % 7 != 0);
+                          if (label)
+                              CHECK_EQ(*label, std::format("a label longer than inline {}", id));
+                          CHECK_EQ(price, id * 0.5);
+                          CHECK_EQ(ts.time().time_since_epoch(),
+                                   chr::seconds{1'717'200'000 + id} + chr::nanoseconds{123});
+                          ++expected;
+                      });
+        CHECK_EQ(expected, NUM_ROWS);
+
+        // Each query restarts the generator, SQL sees the column types and names.
+        dfe::for_each(con.Query("select count(*), count(label), sum(id)::BIGINT from gen_rows() "
+                                "where price >= 100"),
+                      [&](int64_t count, int64_t labels, int64_t sum)
+                      {
+                          CHECK_EQ(count, NUM_ROWS - 200);
+                          CHECK_LT(labels, count);
+                          CHECK_GT(sum, 0);
+                      });
+
+        dfe::for_each(con.Query("select typeof(id), typeof(label), typeof(price), typeof(ts) "
+                                "from gen_rows() limit 1"),
+                      [](std::string id, std::string label, std::string price, std::string ts)
+                      {
+                          CHECK_EQ(id, "BIGINT");
+                          CHECK_EQ(label, "VARCHAR");
+                          CHECK_EQ(price, "DOUBLE");
+                          CHECK_EQ(ts, "TIMESTAMP_NS");
+                      });
+    }
+
+    SUBCASE("range generator and other connections")
+    {
+        std::vector<std::tuple<int32_t, dfe::year_month_day, std::string>> rows;
+        for (int32_t i{0}; i < 3000; ++i)
+            rows.emplace_back(i, chr::year{2024} / chr::June / (i % 28 + 1), std::to_string(i));
+
+        dfe::register_table_function<int32_t, dfe::year_month_day, std::string>(
+            con, "gen_dates", rows);
+
+        ddb::Connection other{db};
+        for (auto* c : {&con, &other})
+        {
+            std::size_t numRows{0};
+            dfe::for_each(c->Query("select col0, col1, col2 from gen_dates()"),
+                          [&](int32_t i, dfe::year_month_day date, std::string label)
+                          {
+                              CHECK_EQ(date, std::get<1>(rows[i]));
+                              CHECK_EQ(label, std::to_string(i));
+                              ++numRows;
+                          });
+            CHECK_EQ(numRows, rows.size());
+        }
+    }
+
+    SUBCASE("projection and re-registration")
+    {
+        CountingGenerator generator;
+        dfe::register_table_function<int64_t, std::string>(con, "gen_count", generator,
+                                                           {"id", "label"});
+
+        int64_t sum{0};
+        dfe::for_each(con.Query("select id from gen_count()"), [&](int64_t id) { sum += id; });
+        CHECK_EQ(sum, 5000 * 5001 / 2);
+        CHECK_EQ(*generator.produced, 5000);
+
+        dfe::register_table_function<int64_t>(con, "gen_count",
+                                              std::vector{std::tuple<int64_t>{42}});
+        dfe::for_each(con.Query("select * from gen_count()"),
+                      [](int64_t value) { CHECK_EQ(value, 42); });
+    }
+
+    SUBCASE("errors")
+    {
+        CHECK_THROWS_AS(dfe::register_table_function<int64_t>(
+                            con, "gen_bad", RowGenerator{}, {"a", "b"}),
+                        std::invalid_argument);
+
+        dfe::register_table_function<int64_t>(
+            con, "gen_throw",
+            []() -> std::optional<std::tuple<int64_t>> { throw std::runtime_error{"stop"}; });
+        auto result{con.Query("select * from gen_throw()")};
+        CHECK(result->HasError());
+    }
+}
@@ -388,3 +388,105 @@ TEST_CASE("bool")
     CHECK_EQ(num_false, 1);
     CHECK_EQ(num_true + num_false, 3);
 }
+
+TEST_CASE("Test vectorized conversions")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    // Use multiple chunks, values fit in int16_t except the one at OVERFLOW_ROW.
+    constexpr int64_t NUM_ROWS{5000};
+    constexpr int64_t OVERFLOW_ROW{4500};
+
+    auto res{con.Query(std::format("CREATE TABLE t AS "
+                                   "SELECT i - 2500 AS sval, i AS uval, i * 0.5 AS fval "
+                                   "FROM range({}) t(i)",
+                                   NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+    REQUIRE_FALSE(con.Query("ALTER TABLE t ALTER fval TYPE FLOAT")->HasError());
+
+    SUBCASE("narrowing and widening conversions")
+    {
+        int64_t num_rows{0};
+        CHECK_NOTHROW(dfe::for_each(con.Query("select sval, uval, fval, sval from t order by uval"),
+                                    [&](int16_t sval, uint16_t uval, double fval, double dval)
+                                    {
+                                        CHECK_EQ(sval, num_rows - 2500);
+                                        CHECK_EQ(uval, num_rows);
+                                        CHECK_EQ(fval, num_rows * 0.5);
+                                        CHECK_EQ(dval, num_rows - 2500);
+                                        ++num_rows;
+                                    }));
+        CHECK_EQ(num_rows, NUM_ROWS);
+    }
+
+    SUBCASE("report the overflow row")
+    {
+        REQUIRE_FALSE(
+            con.Query(std::format("UPDATE t SET sval = 100000 WHERE uval = {}", OVERFLOW_ROW))
+                ->HasError());
+
+        int64_t num_rows{0};
+        try
+        {
+            dfe::for_each(con.Query("select uval, sval from t order by uval"),
+                          [&](int64_t, int16_t) { ++num_rows; });
+            FAIL("overflow not detected");
+        }
+        catch (const std::invalid_argument& ex)
+        {
+            CHECK_EQ(std::string{ex.what()},
+                     std::format("Cannot convert value 100000 at column 2 row {} of type "
+                                 "BIGINT to int16",
+                                 OVERFLOW_ROW + 1));
+        }
+
+        // Rows before the overflow are processed.
+        CHECK_EQ(num_rows, OVERFLOW_ROW);
+
+        // Columns that are not vectorized, like HUGEINT, report the same error.
+        num_rows = 0;
+        try
+        {
+            dfe::for_each(con.Query("select uval, sval::HUGEINT from t order by uval"),
+                          [&](int64_t, int16_t) { ++num_rows; });
+            FAIL("overflow not detected");
+        }
+        catch (const std::invalid_argument& ex)
+        {
+            CHECK_EQ(std::string{ex.what()},
+                     std::format("Cannot convert value 100000 at column 2 row {} of type "
+                                 "HUGEINT to int16",
+                                 OVERFLOW_ROW + 1));
+        }
+        CHECK_EQ(num_rows, OVERFLOW_ROW);
+    }
+
+    SUBCASE("signed to unsigned conversions")
+    {
+        CHECK_THROWS_AS(dfe::for_each(con.Query("select sval from t"), [](uint64_t) {}),
+                        std::invalid_argument);
+        CHECK_NOTHROW(
+            dfe::for_each(con.Query("select sval from t where sval >= 0"), [](uint16_t) {}));
+        CHECK_THROWS_AS(
+            dfe::for_each(con.Query("select sval from t where sval >= 0"), [](uint8_t) {}),
+            std::invalid_argument);
+    }
+
+    SUBCASE("nulls are not range checked")
+    {
+        REQUIRE_FALSE(con.Query("UPDATE t SET sval = null WHERE uval % 3 = 0")->HasError());
+
+        size_t num_nulls{0};
+        CHECK_NOTHROW(dfe::for_each(con.Query("select sval from t where sval is null "
+                                              "or (sval >= -128 and sval <= 127)"),
+                                    [&](std::optional<int8_t> sval)
+                                    {
+                                        if (!sval)
+                                            ++num_nulls;
+                                    }));
+        CHECK_EQ(num_nulls, (NUM_ROWS + 2) / 3);
+
+        CHECK_THROWS(dfe::for_each(con.Query("select sval from t"), [](int64_t) {}));
+    }
+}
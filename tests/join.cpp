@@ -0,0 +1,152 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+using Order = std::tuple<std::optional<int64_t>, int64_t, double>;
+using Customer = std::tuple<std::string, int64_t>;
+
+struct Matches
+{
+    std::size_t count{0};
+    double amount{0};
+    int64_t last{-1};
+
+    void operator()(const Order& order, const Customer& customer)
+    {
+        auto [id, day, amount] = order;
+        REQUIRE(id);
+        CHECK_EQ(*id, std::get<1>(customer));
+        CHECK_LE(last, *id);
+
+        last = *id;
+        ++count;
+        this->amount += amount;
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test merge join")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    // Orders with many rows per customer, customers with up to 3 rows per id and some
+    // customers without orders. NULL ids never match.
+    auto res{con.Query("CREATE TABLE orders AS "
+                       "SELECT CASE WHEN i % 101 = 0 THEN NULL ELSE i % 997 END AS id, "
+                       "i % 31 AS day, i * 0.5 AS amount FROM range(20000) t(i)")};
+    REQUIRE_FALSE(res->HasError());
+    res = con.Query("CREATE TABLE customers AS "
+                    "SELECT 'name' || i AS name, (i // 3) * 2 AS id FROM range(1500) t(i)");
+    REQUIRE_FALSE(res->HasError());
+
+    std::size_t expectedCount{0};
+    double expectedAmount{0};
+    dfe::for_each(con.Query("select count(*), sum(amount) from orders join customers using (id)"),
+                  [&](int64_t count, double amount)
+                  {
+                      expectedCount = count;
+                      expectedAmount = amount;
+                  });
+    REQUIRE_GT(expectedCount, 0);
+
+    ddb::Connection con1{db}, con2{db};
+
+    SUBCASE("many to many")
+    {
+        auto matches{dfe::merge_join(
+            con1.SendQuery("select id, day, amount from orders order by id"),
+            con2.SendQuery("select name, id from customers order by id"), {{0, 1}}, Matches{})};
+
+        CHECK_EQ(matches.count, expectedCount);
+        CHECK_EQ(matches.amount, doctest::Approx(expectedAmount));
+    }
+
+    SUBCASE("composite keys")
+    {
+        std::size_t count{0};
+        dfe::merge_join(con1.Query("select id, day, amount from orders where id is not null "
+                                   "order by id, day"),
+                        con2.Query("select distinct id, id % 31 from orders "
+                                   "where id is not null order by 1, 2"),
+                        {{0, 0}, {1, 1}},
+                        [&](const Order& order, std::tuple<int64_t, int64_t> key)
+                        {
+                            CHECK_EQ(std::get<0>(order), std::get<0>(key));
+                            CHECK_EQ(std::get<1>(order), std::get<1>(key));
+                            ++count;
+                        });
+
+        std::size_t expected{0};
+        dfe::for_each(con.Query("select count(*) from orders where id % 31 = day"),
+                      [&](int64_t n) { expected = n; });
+        CHECK_EQ(count, expected);
+    }
+
+    SUBCASE("empty results")
+    {
+        auto matches{dfe::merge_join(
+            con1.Query("select id, day, amount from orders where false"),
+            con2.Query("select name, id from customers order by id"), {{0, 1}}, Matches{})};
+        CHECK_EQ(matches.count, 0);
+    }
+
+    SUBCASE("mixed signed and unsigned keys")
+    {
+        std::vector<int64_t> keys;
+        dfe::merge_join(con1.Query("select i - 5 from range(10) t(i) order by 1"),
+                        con2.Query("select i::UBIGINT from range(5) t(i) order by 1"), {{0, 0}},
+                        [&](std::tuple<int64_t> left, std::tuple<uint64_t> right)
+                        {
+                            CHECK_EQ(std::get<0>(left), std::get<0>(right));
+                            keys.push_back(std::get<0>(left));
+                        });
+        CHECK_EQ(keys, std::vector<int64_t>{0, 1, 2, 3, 4});
+    }
+
+    SUBCASE("errors")
+    {
+        // Unordered results.
+        CHECK_THROWS_AS(dfe::merge_join(con1.Query("select id, day, amount from orders "
+                                                   "where id is not null"),
+                                        con2.Query("select name, id from customers order by id"),
+                                        {{0, 1}}, Matches{}),
+                        std::invalid_argument);
+
+        // Invalid key columns.
+        CHECK_THROWS_AS(dfe::merge_join(con1.Query("select id, day, amount from orders"),
+                                        con2.Query("select name, id from customers"), {{0, 0}},
+                                        Matches{}),
+                        std::invalid_argument);
+        CHECK_THROWS_AS(dfe::merge_join(con1.Query("select id, day, amount from orders"),
+                                        con2.Query("select name, id from customers"), {{3, 1}},
+                                        Matches{}),
+                        std::invalid_argument);
+        CHECK_THROWS_AS(dfe::merge_join(con1.Query("select id, day, amount from orders"),
+                                        con2.Query("select name, id from customers"), {},
+                                        Matches{}),
+                        std::invalid_argument);
+
+        // Wrong number of columns and query errors.
+        CHECK_THROWS_AS(dfe::merge_join(con1.Query("select id, day from orders"),
+                                        con2.Query("select name, id from customers"), {{0, 1}},
+                                        Matches{}),
+                        std::invalid_argument);
+        CHECK_THROWS(dfe::merge_join(con1.Query("select * from notable"),
+                                     con2.Query("select name, id from customers"), {{0, 1}},
+                                     Matches{}));
+    }
+}
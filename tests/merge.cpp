@@ -0,0 +1,115 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+TEST_CASE("Test merge for_each")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    // Three tables with interleaved timestamps: prices every 3s, trades every 5s and
+    // quotes every 7s.
+    for (auto [name, step, rows] : {std::tuple{"prices", 3, 4000}, std::tuple{"trades", 5, 3000},
+                                    std::tuple{"quotes", 7, 10}})
+    {
+        auto res{con.Query(std::format("CREATE TABLE {} AS "
+                                       "SELECT TIMESTAMP '2024-06-01' + INTERVAL (i * {}) SECOND "
+                                       "AS ts, '{}' || i AS label FROM range({}) t(i)",
+                                       name, step, name, rows))};
+        REQUIRE_FALSE(res->HasError());
+    }
+
+    ddb::Connection con1{db}, con2{db}, con3{db};
+
+    SUBCASE("global order")
+    {
+        const std::string names[]{"prices", "trades", "quotes"};
+        std::vector<std::size_t> counts(3);
+        dfe::Timestamp last;
+        std::size_t lastSource{0}, numRows{0};
+
+        dfe::merge_for_each(0,
+                            {con1.SendQuery("select ts, label from prices order by ts"),
+                             con2.SendQuery("select ts, label from trades order by ts"),
+                             con3.SendQuery("select ts, label from quotes order by ts")},
+                            [&](std::size_t source, dfe::Timestamp ts, std::string label)
+                            {
+                                CHECK_LE(last, ts);
+                                CHECK_EQ(label,
+                                         std::format("{}{}", names[source], counts[source]));
+
+                                // Equal keys are delivered in source order.
+                                if (numRows > 0 && ts == last)
+                                    CHECK_GT(source, lastSource);
+
+                                last = ts;
+                                lastSource = source;
+                                ++counts[source];
+                                ++numRows;
+                            });
+
+        CHECK_EQ(counts, std::vector<std::size_t>{4000, 3000, 10});
+    }
+
+    SUBCASE("results vector and key column")
+    {
+        std::vector<std::unique_ptr<ddb::QueryResult>> results;
+        results.push_back(con1.Query("select label, epoch(ts)::BIGINT from prices order by 2"));
+        results.push_back(con2.Query("select label, epoch(ts)::BIGINT from trades where false"));
+        results.push_back(con3.Query("select label, epoch(ts)::BIGINT from quotes order by 2"));
+
+        int64_t last{-1};
+        std::size_t numRows{0};
+        dfe::merge_for_each(1, std::move(results),
+                            [&](std::size_t, std::string, int64_t secs)
+                            {
+                                CHECK_LE(last, secs);
+                                last = secs;
+                                ++numRows;
+                            });
+        CHECK_EQ(numRows, 4010);
+    }
+
+    SUBCASE("errors")
+    {
+        auto f = [](std::size_t, dfe::Timestamp, std::string) {};
+
+        // Unordered result.
+        CHECK_THROWS_AS(dfe::merge_for_each(0,
+                                            {con1.SendQuery("select ts, label from prices"),
+                                             con2.SendQuery("select ts, label from trades "
+                                                            "order by ts desc")},
+                                            f),
+                        std::invalid_argument);
+
+        // Unordered string keys passed by value.
+        CHECK_THROWS_AS(dfe::merge_for_each(
+                            0, {con1.SendQuery("select label, ts from prices order by ts")},
+                            [](std::size_t, std::string label, dfe::Timestamp)
+                            { auto moved{std::move(label)}; }),
+                        std::invalid_argument);
+
+        // Different number of columns.
+        CHECK_THROWS_AS(dfe::merge_for_each(0,
+                                            {con1.SendQuery("select ts, label from prices"),
+                                             con2.SendQuery("select ts from trades")},
+                                            f),
+                        std::invalid_argument);
+
+        // Invalid key column.
+        CHECK_THROWS_AS(dfe::merge_for_each(
+                            2, {con1.SendQuery("select ts, label from prices")}, f),
+                        std::invalid_argument);
+
+        CHECK_THROWS_AS(dfe::merge_for_each(0, {con1.SendQuery("select * from notable")}, f),
+                        std::runtime_error);
+    }
+}
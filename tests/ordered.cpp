@@ -0,0 +1,167 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+struct Mapped
+{
+    int64_t ival;
+    uint64_t hash;
+};
+
+// A CPU bound map function.
+Mapped hash_row(int64_t ival, const std::string& sval)
+{
+    uint64_t hash{14695981039346656037ULL};
+    for (int round{0}; round < 8; ++round)
+    {
+        for (char c : sval)
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    return {ival, hash};
+}
+
+struct Collector
+{
+    std::vector<Mapped> values;
+
+    void operator()(Mapped value) { values.push_back(value); }
+};
+
+} // namespace
+
+TEST_CASE("Test parallel_for_each")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{50'000};
+
+    auto res{con.Query(std::format("CREATE TABLE t AS "
+                                   "SELECT i AS ival, 'a string longer than inline ' || i AS sval "
+                                   "FROM range({}) t(i)",
+                                   NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    // Expected output computed on the calling thread.
+    std::vector<Mapped> expected;
+    dfe::for_each(con.Query("select ival, sval from t order by ival desc"),
+                  [&](int64_t ival, const std::string& sval)
+                  { expected.push_back(hash_row(ival, sval)); });
+    REQUIRE_EQ(expected.size(), NUM_ROWS);
+
+    for (size_t nthreads : {1, 2, 4})
+    {
+        CAPTURE(nthreads);
+
+        auto out{dfe::parallel_for_each(con.Query("select ival, sval from t order by ival desc"),
+                                        hash_row, Collector{}, nthreads)};
+
+        REQUIRE_EQ(out.values.size(), expected.size());
+        for (size_t i{0}; i < expected.size(); ++i)
+        {
+            if (out.values[i].ival != expected[i].ival || out.values[i].hash != expected[i].hash)
+            {
+                FAIL_CHECK("Mismatch at row ", i);
+                break;
+            }
+        }
+    }
+
+    SUBCASE("stream results")
+    {
+        int64_t next{0};
+        size_t num_rows{0};
+        dfe::parallel_for_each(
+            con.SendQuery("select ival from t order by ival"),
+            [](int64_t ival) { return ival * 2; },
+            [&](int64_t value)
+            {
+                CHECK_EQ(value, next * 2);
+                ++next;
+                ++num_rows;
+            },
+            3);
+
+        CHECK_EQ(num_rows, NUM_ROWS);
+    }
+
+    SUBCASE("reference results")
+    {
+        std::vector<std::string> values;
+        dfe::parallel_for_each(
+            con.Query("select sval from t order by ival limit 3"),
+            [](const std::string& sval) -> const std::string& { return sval; },
+            [&](std::string value) { values.push_back(std::move(value)); },
+            2);
+
+        CHECK_EQ(values, std::vector<std::string>{"a string longer than inline 0",
+                                                  "a string longer than inline 1",
+                                                  "a string longer than inline 2"});
+    }
+
+    SUBCASE("empty results")
+    {
+        auto out{dfe::parallel_for_each(con.Query("select ival, sval from t where ival < 0"),
+                                        hash_row, Collector{}, 2)};
+        CHECK(out.values.empty());
+    }
+
+    SUBCASE("errors")
+    {
+        // Wrong number of columns.
+        CHECK_THROWS_AS(
+            dfe::parallel_for_each(con.Query("select ival from t"), hash_row, Collector{}),
+            std::invalid_argument);
+
+        // Conversion errors on worker threads.
+        CHECK_THROWS_AS(dfe::parallel_for_each(
+                            con.Query("select ival from t"), [](int8_t v) { return v; },
+                            [](int8_t) {}, 2),
+                        std::invalid_argument);
+
+        // Exceptions thrown by map.
+        CHECK_THROWS_AS(dfe::parallel_for_each(
+                            con.Query("select ival from t"),
+                            [](int64_t ival)
+                            {
+                                if (ival == NUM_ROWS / 2)
+                                    throw std::runtime_error{"map"};
+                                return ival;
+                            },
+                            [](int64_t) {}, 2),
+                        std::runtime_error);
+
+        // Exceptions thrown by the sink stop the workers.
+        size_t num_values{0};
+        CHECK_THROWS_AS(dfe::parallel_for_each(
+                            con.SendQuery("select ival from t"), [](int64_t ival) { return ival; },
+                            [&](int64_t)
+                            {
+                                if (++num_values == 5000)
+                                    throw std::runtime_error{"sink"};
+                            },
+                            2),
+                        std::runtime_error);
+        CHECK_EQ(num_values, 5000);
+
+        // Query errors while fetching.
+        const std::string query{"select (case when ival < 25000 "
+                                "then ival::varchar else 'x' end)::integer from t"};
+        CHECK_THROWS_AS(dfe::parallel_for_each(
+                            con.SendQuery(query), [](int32_t v) { return v; }, [](int32_t) {}, 2),
+                        std::runtime_error);
+
+        CHECK_THROWS(dfe::parallel_for_each(
+            nullptr, [](int64_t v) { return v; }, [](int64_t) {}));
+    }
+}
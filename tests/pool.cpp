@@ -0,0 +1,130 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+struct Summer
+{
+    int64_t sum{0};
+
+    void operator()(int64_t ival)
+    {
+        sum += ival;
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test connection pool")
+{
+    ddb::DuckDB db;
+
+    constexpr int64_t NUM_ROWS{5000};
+    {
+        ddb::Connection con{db};
+        auto res{con.Query(std::format("CREATE TABLE t AS SELECT i AS ival FROM range({}) t(i)",
+                                       NUM_ROWS))};
+        REQUIRE_FALSE(res->HasError());
+    }
+
+    SUBCASE("connections and statements are reused")
+    {
+        dfe::ConnectionPool pool{db, 2};
+
+        ddb::Connection* first{nullptr};
+        ddb::PreparedStatement* stmt{nullptr};
+        {
+            auto con{pool.acquire()};
+            first = &*con;
+            stmt = &con.prepare("select count(*) from t where ival < ?");
+            CHECK_EQ(&con.prepare("select count(*) from t where ival < ?"), stmt);
+        }
+
+        auto con{pool.acquire()};
+        CHECK_EQ(&*con, first);
+        CHECK_EQ(&con.prepare("select count(*) from t where ival < ?"), stmt);
+        CHECK_EQ(pool.size(), 1);
+
+        int64_t count{0};
+        dfe::for_each(con->Query("select count(*) from t"), [&](int64_t n) { count = n; });
+        CHECK_EQ(count, NUM_ROWS);
+    }
+
+    SUBCASE("acquire waits for a free connection")
+    {
+        dfe::ConnectionPool pool{db, 2};
+
+        std::optional<dfe::ConnectionPool::Handle> con1{pool.acquire()};
+        auto con2{pool.acquire()};
+
+        std::atomic<bool> acquired{false};
+        std::thread waiter{[&]
+                           {
+                               auto con{pool.acquire()};
+                               acquired = true;
+                           }};
+
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        CHECK_FALSE(acquired);
+
+        con1.reset();
+        waiter.join();
+        CHECK(acquired);
+        CHECK_EQ(pool.size(), 2);
+    }
+
+    SUBCASE("concurrent for_each")
+    {
+        dfe::ConnectionPool pool{db, 4};
+
+        std::atomic<std::size_t> numErrors{0};
+        std::vector<std::thread> threads;
+        for (int64_t i{0}; i < 8; ++i)
+        {
+            threads.emplace_back(
+                [&, i]
+                {
+                    for (int64_t n{0}; n < 20; ++n)
+                    {
+                        int64_t limit{i * 100 + n};
+                        auto summer{
+                            pool.for_each("select ival from t where ival < ?", Summer{}, limit)};
+                        if (summer.sum != limit * (limit - 1) / 2)
+                            ++numErrors;
+                    }
+                });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        CHECK_EQ(numErrors, 0);
+        CHECK_LE(pool.size(), 4);
+    }
+
+    SUBCASE("errors")
+    {
+        dfe::ConnectionPool pool{db, 1};
+
+        CHECK_THROWS_AS(pool.for_each("select * from notable", [](int64_t) {}),
+                        std::runtime_error);
+        CHECK_THROWS_AS(pool.for_each("select ival from t where ival < ?", [](int8_t) {}, 1000),
+                        std::invalid_argument);
+
+        // The connection is back in the pool.
+        CHECK_EQ(pool.for_each("select ival from t where ival < ?", Summer{}, 10).sum, 45);
+        CHECK_EQ(pool.size(), 1);
+    }
+}
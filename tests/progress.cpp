@@ -0,0 +1,141 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+namespace chr = std::chrono;
+
+TEST_CASE("Test progress and cancellation")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{100'000};
+
+    auto res{con.Query(
+        std::format("CREATE TABLE t AS SELECT i AS ival FROM range({}) t(i)", NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    SUBCASE("progress of materialized results")
+    {
+        std::vector<dfe::Progress> reports;
+        int64_t numRows{0};
+        dfe::for_each(con.Query("select ival from t"), [&](int64_t) { ++numRows; },
+                      {.progress = [&](const dfe::Progress& p) { reports.push_back(p); }});
+
+        REQUIRE_GT(reports.size(), 1);
+        CHECK_EQ(reports.size(), reports.back().chunks);
+        CHECK_EQ(reports.back().rows, NUM_ROWS);
+        CHECK_EQ(reports.back().percent, 100);
+        for (std::size_t i{1}; i < reports.size(); ++i)
+        {
+            CHECK_GT(reports[i].rows, reports[i - 1].rows);
+            CHECK_GT(reports[i].percent, reports[i - 1].percent);
+        }
+        CHECK_EQ(numRows, NUM_ROWS);
+    }
+
+    SUBCASE("progress of stream results")
+    {
+        REQUIRE_FALSE(con.Query("SET enable_progress_bar = true")->HasError());
+        REQUIRE_FALSE(con.Query("SET enable_progress_bar_print = false")->HasError());
+
+        // DuckDB estimates the progress of scans that span a few row groups.
+        REQUIRE_FALSE(
+            con.Query("CREATE TABLE large AS SELECT i AS ival FROM range(1000000) t(i)")
+                ->HasError());
+
+        std::vector<dfe::Progress> reports;
+        dfe::for_each(con.SendQuery("select ival from large"), [](int64_t) {},
+                      {.progress = [&](const dfe::Progress& p) { reports.push_back(p); }});
+
+        REQUIRE_GT(reports.size(), 1);
+        CHECK_EQ(reports.back().percent, 100);
+
+        // The reports before the last one come from the DuckDB query progress.
+        std::size_t numEstimates{0};
+        for (std::size_t i{0}; i + 1 < reports.size(); ++i)
+        {
+            CHECK_GE(reports[i].percent, -1);
+            CHECK_LE(reports[i].percent, 100);
+            if (reports[i].percent > 0 && reports[i].percent < 100)
+                ++numEstimates;
+        }
+        CHECK_GT(numEstimates, 0);
+    }
+
+    SUBCASE("cancel from the function object")
+    {
+        dfe::CancellationToken token;
+        int64_t numRows{0};
+        auto fn{dfe::for_each(con.SendQuery("select ival from t"),
+                              [&](int64_t)
+                              {
+                                  if (++numRows == 100)
+                                      token.cancel();
+                                  return numRows;
+                              },
+                              {.cancellation = &token})};
+
+        // The chunk being processed is completed.
+        CHECK_EQ(numRows, STANDARD_VECTOR_SIZE);
+        CHECK(token.cancelled());
+
+        // The connection can run other queries.
+        int64_t count{0};
+        dfe::for_each(con.Query("select count(*) from t"), [&](int64_t n) { count = n; });
+        CHECK_EQ(count, NUM_ROWS);
+    }
+
+    SUBCASE("cancel before starting")
+    {
+        dfe::CancellationToken token;
+        token.cancel();
+
+        int64_t numRows{0};
+        dfe::for_each(con.SendQuery("select ival from t"), [&](int64_t) { ++numRows; },
+                      {.cancellation = &token});
+        CHECK_EQ(numRows, 0);
+    }
+
+    SUBCASE("cancel a running query")
+    {
+        dfe::CancellationToken token;
+        std::thread canceller{[&]
+                              {
+                                  std::this_thread::sleep_for(chr::milliseconds{200});
+                                  token.cancel();
+                              }};
+
+        // Streams a few rows per second for hours unless interrupted.
+        auto start{chr::steady_clock::now()};
+        int64_t numRows{0};
+        dfe::for_each(con.SendQuery("select i from range(1000000000000) t(i) "
+                                    "where i % 100000000 = 0"),
+                      [&](int64_t) { ++numRows; }, {.cancellation = &token});
+        canceller.join();
+
+        CHECK_LT(numRows, 1000);
+        CHECK_LT(chr::steady_clock::now() - start, chr::seconds{30});
+
+        int64_t count{0};
+        dfe::for_each(con.Query("select count(*) from t"), [&](int64_t n) { count = n; });
+        CHECK_EQ(count, NUM_ROWS);
+    }
+
+    SUBCASE("errors without cancellation")
+    {
+        dfe::CancellationToken token;
+        CHECK_THROWS_AS(dfe::for_each(con.SendQuery("select (case when ival < 50000 then "
+                                                    "ival::varchar else 'x' end)::integer from t"),
+                                      [](int32_t) {}, {.cancellation = &token}),
+                        std::runtime_error);
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <stdexcept>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+struct Agg
+{
+    size_t count{0};
+    double sum{0};
+    int64_t volume{0};
+};
+
+} // namespace
+
+TEST_CASE("Test reduce_by")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{50'000};
+    constexpr int64_t NUM_KEYS{100};
+
+    auto res{con.Query(std::format("CREATE TABLE t AS "
+                                   "SELECT 'SYM' || (i % {1}) AS symbol, i AS ival, "
+                                   "i * 0.5 AS close, i % 7 AS volume "
+                                   "FROM range({0}) t(i)",
+                                   NUM_ROWS, NUM_KEYS))};
+    REQUIRE_FALSE(res->HasError());
+
+    // Expected aggregates computed by DuckDB.
+    std::unordered_map<std::string, Agg> expected;
+    dfe::for_each(con.Query("select symbol, count(*), sum(close), sum(volume) "
+                            "from t group by symbol"),
+                  [&](std::string sym, int64_t count, double sum, int64_t volume) {
+                      expected[sym] = Agg{static_cast<size_t>(count), sum, volume};
+                  });
+    REQUIRE_EQ(expected.size(), NUM_KEYS);
+
+    auto fold = [](Agg& agg, double close, int64_t volume)
+    {
+        ++agg.count;
+        agg.sum += close;
+        agg.volume += volume;
+    };
+
+    auto merge = [](Agg& lhs, const Agg& rhs)
+    {
+        lhs.count += rhs.count;
+        lhs.sum += rhs.sum;
+        lhs.volume += rhs.volume;
+    };
+
+    for (size_t nthreads : {1, 2, 4})
+    {
+        CAPTURE(nthreads);
+
+        auto aggs{dfe::reduce_by<std::string>(con.Query("select symbol, close, volume from t"),
+                                              Agg{}, fold, merge, nthreads)};
+
+        REQUIRE_EQ(aggs.size(), expected.size());
+        for (auto& [sym, agg] : aggs)
+        {
+            auto& exp{expected.at(sym)};
+            CHECK_EQ(agg.count, exp.count);
+            CHECK_EQ(agg.sum, doctest::Approx(exp.sum));
+            CHECK_EQ(agg.volume, exp.volume);
+        }
+    }
+
+    SUBCASE("integer keys and stream results")
+    {
+        auto counts{dfe::reduce_by<int64_t>(
+            con.SendQuery("select ival % 10, ival from t"), int64_t{0},
+            [](int64_t& count, int64_t) { ++count; },
+            [](int64_t& lhs, int64_t rhs) { lhs += rhs; }, 3)};
+
+        REQUIRE_EQ(counts.size(), 10);
+        for (auto& [key, count] : counts)
+            CHECK_EQ(count, NUM_ROWS / 10);
+    }
+
+    SUBCASE("errors")
+    {
+        // Wrong number of columns.
+        CHECK_THROWS_AS(dfe::reduce_by<std::string>(con.Query("select symbol, close from t"),
+                                                    Agg{}, fold, merge),
+                        std::invalid_argument);
+
+        // Conversion errors on worker threads.
+        CHECK_THROWS_AS(dfe::reduce_by<int8_t>(con.Query("select ival, close, volume from t"),
+                                               Agg{}, fold, merge, 2),
+                        std::invalid_argument);
+
+        // Exceptions thrown by fold.
+        CHECK_THROWS_AS(dfe::reduce_by<std::string>(
+                            con.Query("select symbol, close, volume from t"), Agg{},
+                            [](Agg&, double, int64_t) { throw std::runtime_error{"fold"}; },
+                            merge, 2),
+                        std::runtime_error);
+    }
+}
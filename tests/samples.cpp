@@ -0,0 +1,137 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+struct Collector
+{
+    std::vector<int64_t> ids;
+
+    void operator()(int64_t id, double)
+    {
+        ids.push_back(id);
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test sampling")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{200'000};
+
+    auto res{con.Query(std::format(
+        "CREATE TABLE t AS SELECT i AS id, i / 2 AS rval FROM range({}) t(i)", NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    SUBCASE("number of rows")
+    {
+        auto ids{dfe::for_each_sample(con, "t", 1000, Collector{}).ids};
+        CHECK_EQ(ids.size(), 1000);
+
+        std::ranges::sort(ids);
+        CHECK_EQ(std::ranges::unique(ids).begin(), ids.end());
+        CHECK_LT(ids.back(), NUM_ROWS);
+
+        // Booleans and characters are not numbers of rows.
+        auto acceptsSize = []<typename N>(N)
+        {
+            return requires(ddb::Connection& c) {
+                dfe::for_each_sample(c, "t", N{}, Collector{});
+            };
+        };
+        CHECK(acceptsSize(int64_t{}));
+        CHECK(acceptsSize(uint16_t{}));
+        CHECK_FALSE(acceptsSize(true));
+        CHECK_FALSE(acceptsSize('a'));
+    }
+
+    SUBCASE("fractions")
+    {
+        // System samples pick whole vectors, a seed on one thread keeps the size stable.
+        REQUIRE_FALSE(con.Query("SET threads = 1")->HasError());
+
+        for (auto method : {dfe::SampleMethod::system, dfe::SampleMethod::bernoulli,
+                            dfe::SampleMethod::reservoir})
+        {
+            auto ids{dfe::for_each_sample(con, "t", 0.1, Collector{},
+                                          {.method = method, .seed = 42})
+                         .ids};
+            CHECK_GT(ids.size(), NUM_ROWS / 20);
+            CHECK_LT(ids.size(), NUM_ROWS / 5);
+        }
+
+        CHECK(dfe::for_each_sample(con, "t", 0.0, Collector{}).ids.empty());
+        CHECK_EQ(dfe::for_each_sample(con, "t", 1.0, Collector{}).ids.size(), NUM_ROWS);
+    }
+
+    SUBCASE("columns and subqueries")
+    {
+        int64_t count{0};
+        dfe::for_each_sample(con, "(select * from t where id % 2 = 0)", 100,
+                             [&](int64_t id)
+                             {
+                                 CHECK_EQ(id % 2, 0);
+                                 ++count;
+                             },
+                             {.columns = "id"});
+        CHECK_EQ(count, 100);
+    }
+
+    SUBCASE("repeatable samples")
+    {
+        REQUIRE_FALSE(con.Query("SET threads = 1")->HasError());
+
+        const dfe::SampleOptions options{.method = dfe::SampleMethod::bernoulli, .seed = 42};
+        auto first{dfe::for_each_sample(con, "t", 0.01, Collector{}, options).ids};
+        auto second{dfe::for_each_sample(con, "t", 0.01, Collector{}, options).ids};
+        CHECK_FALSE(first.empty());
+        CHECK_EQ(first, second);
+    }
+
+    SUBCASE("random chunk order")
+    {
+        auto ids{dfe::for_each_sample(con, "t", 1.0, Collector{},
+                                      {.seed = 7, .random_order = true})
+                     .ids};
+        REQUIRE_EQ(ids.size(), NUM_ROWS);
+        CHECK_FALSE(std::ranges::is_sorted(ids));
+
+        // Rows in a chunk keep their order.
+        CHECK(std::is_sorted(ids.begin(), ids.begin() + 100));
+
+        std::ranges::sort(ids);
+        for (int64_t i{0}; i < NUM_ROWS; ++i)
+            REQUIRE_EQ(ids[i], i);
+
+        // Same seed same order.
+        REQUIRE_FALSE(con.Query("SET threads = 1")->HasError());
+        const dfe::SampleOptions options{.seed = 3, .random_order = true};
+        auto lhs{dfe::for_each_sample(con, "t", 0.5, Collector{}, options).ids};
+        auto rhs{dfe::for_each_sample(con, "t", 0.5, Collector{}, options).ids};
+        CHECK_EQ(lhs, rhs);
+    }
+
+    SUBCASE("errors")
+    {
+        CHECK_THROWS_AS(dfe::for_each_sample(con, "t", 1.5, Collector{}), std::invalid_argument);
+        CHECK_THROWS_AS(dfe::for_each_sample(con, "t", -1, Collector{}), std::invalid_argument);
+        CHECK_THROWS_AS(dfe::for_each_sample(con, "notable", 10, Collector{}),
+                        std::runtime_error);
+        CHECK_THROWS_AS(dfe::for_each_sample(con, "notable", 10, Collector{},
+                                             {.random_order = true}),
+                        std::runtime_error);
+    }
+}
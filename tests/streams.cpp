@@ -0,0 +1,109 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <stdexcept>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+struct RowCounter
+{
+    size_t num_rows{0};
+    int64_t last{-1};
+
+    void operator()(int64_t ival, std::string)
+    {
+        CHECK_EQ(ival, last + 1);
+        last = ival;
+        ++num_rows;
+    }
+};
+
+} // namespace
+
+TEST_CASE("Test streaming")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{100'000};
+
+    auto res{con.Query(std::format("CREATE TABLE t AS "
+                                   "SELECT i AS ival, 'a string longer than inline ' || i AS sval "
+                                   "FROM range({}) t(i)",
+                                   NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    SUBCASE("stream result")
+    {
+        dfe::StreamStats stats;
+        auto counter{dfe::for_each(con.SendQuery("select ival, sval from t order by ival"),
+                                   RowCounter{}, {.max_chunks = 2, .stats = &stats})};
+
+        CHECK_EQ(counter.num_rows, NUM_ROWS);
+        CHECK_EQ(stats.rows, NUM_ROWS);
+        CHECK_GE(stats.chunks, NUM_ROWS / STANDARD_VECTOR_SIZE);
+        CHECK_LE(stats.peak_buffered_chunks, 2);
+        CHECK_GT(stats.peak_buffered_bytes, 0);
+    }
+
+    SUBCASE("materialized result")
+    {
+        dfe::StreamStats stats;
+        auto counter{dfe::for_each(con.Query("select ival, sval from t order by ival"),
+                                   RowCounter{}, {.max_chunks = 3, .stats = &stats})};
+
+        CHECK_EQ(counter.num_rows, NUM_ROWS);
+        CHECK_EQ(stats.rows, NUM_ROWS);
+        CHECK_LE(stats.peak_buffered_chunks, 3);
+    }
+
+    SUBCASE("single chunk in memory")
+    {
+        dfe::StreamStats stats;
+        auto counter{dfe::for_each(con.SendQuery("select ival, sval from t order by ival"),
+                                   RowCounter{}, {.max_chunks = 1, .stats = &stats})};
+
+        CHECK_EQ(counter.num_rows, NUM_ROWS);
+        CHECK_EQ(stats.peak_buffered_chunks, 1);
+    }
+
+    SUBCASE("throw on invalid options")
+    {
+        CHECK_THROWS_AS(dfe::for_each(con.SendQuery("select ival, sval from t"), RowCounter{},
+                                      {.max_chunks = 0}),
+                        std::invalid_argument);
+    }
+
+    SUBCASE("exceptions stop the producer")
+    {
+        size_t num_rows{0};
+        CHECK_THROWS_AS(dfe::for_each(con.SendQuery("select ival from t"),
+                                      [&](int64_t ival)
+                                      {
+                                          if (++num_rows == 5000)
+                                              throw std::runtime_error{"stop"};
+                                      },
+                                      {}),
+                        std::runtime_error);
+        CHECK_EQ(num_rows, 5000);
+
+        // Conversion errors.
+        CHECK_THROWS_AS(dfe::for_each(con.SendQuery("select ival from t"), [](int8_t) {}, {}),
+                        std::invalid_argument);
+    }
+
+    SUBCASE("query errors during streaming")
+    {
+        const std::string query{"select (case when ival < 50000 "
+                                "then ival::varchar else 'x' end)::integer from t"};
+        CHECK_THROWS_AS(dfe::for_each(con.SendQuery(query), [](int32_t) {}, {}),
+                        std::runtime_error);
+        CHECK_THROWS_AS(dfe::for_each(con.SendQuery(query), [](int32_t) {}), std::runtime_error);
+    }
+}
@@ -0,0 +1,144 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+struct Collector
+{
+    std::vector<int64_t> ids;
+
+    void operator()(int64_t id, dfe::Timestamp, double)
+    {
+        ids.push_back(id);
+    }
+};
+
+void append(ddb::Connection& con, int64_t first, int64_t count)
+{
+    auto res{con.Query(std::format("INSERT INTO prices SELECT i, "
+                                   "TIMESTAMP '2024-06-01' + INTERVAL (i) SECOND, i * 0.5 "
+                                   "FROM range({}, {}) t(i)",
+                                   first, first + count))};
+    REQUIRE_FALSE(res->HasError());
+}
+
+std::vector<int64_t> range(int64_t first, int64_t count)
+{
+    std::vector<int64_t> ids(count);
+    std::iota(ids.begin(), ids.end(), first);
+    return ids;
+}
+
+} // namespace
+
+TEST_CASE("Test table tail")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    REQUIRE_FALSE(con.Query("CREATE TABLE prices (id BIGINT, ts TIMESTAMP, close DOUBLE)")
+                      ->HasError());
+    append(con, 0, 5000);
+
+    SUBCASE("new rows only")
+    {
+        dfe::TableTail tail{con, "prices", "ts"};
+        CHECK_FALSE(tail.high_water_mark());
+
+        CHECK_EQ(tail.for_each(Collector{}).ids, range(0, 5000));
+        REQUIRE(tail.high_water_mark());
+        CHECK_EQ(tail.high_water_mark()->ToString(), "2024-06-01 01:23:19");
+
+        CHECK(tail.for_each(Collector{}).ids.empty());
+
+        append(con, 5000, 3);
+        CHECK_EQ(tail.for_each(Collector{}).ids, range(5000, 3));
+        CHECK(tail.for_each(Collector{}).ids.empty());
+    }
+
+    SUBCASE("column list and initial mark")
+    {
+        dfe::TableTail tail{con, "prices", "id", "id", ddb::Value::BIGINT(4990)};
+
+        std::vector<int64_t> ids;
+        tail.for_each([&](int64_t id) { ids.push_back(id); });
+        CHECK_EQ(ids, range(4991, 9));
+
+        append(con, 5000, 1);
+        ids.clear();
+        tail.for_each([&](int64_t id) { ids.push_back(id); });
+        CHECK_EQ(ids, range(5000, 1));
+    }
+
+    SUBCASE("rows of an interrupted chunk are read again")
+    {
+        dfe::TableTail tail{con, "prices", "id", "id"};
+
+        std::vector<int64_t> ids;
+        CHECK_THROWS_AS(tail.for_each(
+                            [&](int64_t id)
+                            {
+                                if (id == 3000)
+                                    throw std::runtime_error{"stop"};
+                                ids.push_back(id);
+                            }),
+                        std::runtime_error);
+
+        REQUIRE(tail.high_water_mark());
+        auto mark{tail.high_water_mark()->GetValue<int64_t>()};
+        CHECK_LT(mark, 3000);
+
+        ids.clear();
+        tail.for_each([&](int64_t id) { ids.push_back(id); });
+        CHECK_EQ(ids, range(mark + 1, 5000 - mark - 1));
+    }
+
+    SUBCASE("NULL order values are skipped")
+    {
+        dfe::TableTail tail{con, "prices", "id", "id"};
+        std::vector<int64_t> ids;
+        auto collect = [&](int64_t id) { ids.push_back(id); };
+
+        tail.for_each(collect);
+        CHECK_EQ(ids.size(), 5000);
+
+        // A NULL row between polls does not stop the tail.
+        REQUIRE_FALSE(con.Query("INSERT INTO prices VALUES (NULL, NULL, 0)")->HasError());
+        append(con, 5000, 2);
+        ids.clear();
+        tail.for_each(collect);
+        CHECK_EQ(ids, range(5000, 2));
+
+        // A first poll that sees the NULL row keeps a valid mark.
+        dfe::TableTail fresh{con, "prices", "id", "id"};
+        ids.clear();
+        fresh.for_each(collect);
+        CHECK_EQ(ids, range(0, 5002));
+        REQUIRE(fresh.high_water_mark());
+        CHECK_EQ(fresh.high_water_mark()->GetValue<int64_t>(), 5001);
+
+        append(con, 5002, 3);
+        ids.clear();
+        fresh.for_each(collect);
+        CHECK_EQ(ids, range(5002, 3));
+    }
+
+    SUBCASE("errors")
+    {
+        dfe::TableTail missing{con, "prices", "ts", "id, close"};
+        CHECK_THROWS_AS(missing.for_each([](int64_t, double) {}), std::invalid_argument);
+
+        dfe::TableTail notable{con, "notable", "ts"};
+        CHECK_THROWS_AS(notable.for_each(Collector{}), std::runtime_error);
+    }
+}
@@ -0,0 +1,268 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace chr = std::chrono;
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+TEST_CASE("Test scalar functions")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{10'000};
+
+    auto res{con.Query(std::format("CREATE TABLE t AS "
+                                   "SELECT i AS ival, i * 0.5 AS rval, "
+                                   "CASE WHEN i % 10 = 0 THEN NULL ELSE 'label ' || i END "
+                                   "AS sval, TIMESTAMP '2024-06-01' + INTERVAL (i) SECOND AS ts "
+                                   "FROM range({}) t(i)",
+                                   NUM_ROWS))};
+    REQUIRE_FALSE(res->HasError());
+
+    SUBCASE("numeric and time arguments")
+    {
+        dfe::register_scalar(con, "weighted",
+                             [](double price, int64_t qty) { return price * qty; });
+        dfe::register_scalar(con, "second_of", [](dfe::Timestamp ts)
+                             { return static_cast<int32_t>(ts.hms().seconds().count()); });
+
+        int64_t numRows{0};
+        dfe::for_each(con.Query("select ival, weighted(rval, ival), second_of(ts) from t "
+                                "order by ival"),
+                      [&](int64_t ival, double weighted, int32_t second)
+                      {
+                          CHECK_EQ(weighted, ival * 0.5 * ival);
+                          CHECK_EQ(second, ival % 60);
+                          ++numRows;
+                      });
+        CHECK_EQ(numRows, NUM_ROWS);
+    }
+
+    SUBCASE("strings and NULL values")
+    {
+        // NULL for non optional arguments gives NULL without calling the function.
+        dfe::register_scalar(con, "label_len", [](const std::string& label)
+                             { return static_cast<int64_t>(label.size()); });
+
+        // Results returned by reference.
+        const std::string prefix{"prefix"};
+        dfe::register_scalar(con, "prefix_of",
+                             [&](int64_t) -> const std::string& { return prefix; });
+
+        // Optional arguments and results.
+        dfe::register_scalar(con, "label_or",
+                             [](std::optional<std::string> label, int64_t ival)
+                             { return label ? *label : std::format("none {}", ival); });
+        dfe::register_scalar(con, "odd_only",
+                             [](int64_t ival) -> std::optional<int64_t>
+                             {
+                                 if (ival % 2 == 0)
+                                     return std::nullopt;
+                                 return ival;
+                             });
+
+        dfe::for_each(con.Query("select ival, label_len(sval), label_or(sval, ival), "
+                                "odd_only(ival), prefix_of(ival) from t"),
+                      [&](int64_t ival, std::optional<int64_t> len, std::string label,
+                          std::optional<int64_t> odd, std::string prefixed)
+                      {
+                          CHECK_EQ(prefixed, prefix);
+                          if (ival % 10 == 0)
+                          {
+                              CHECK_FALSE(len);
+                              CHECK_EQ(label, std::format("none {}", ival));
+                          }
+                          else
+                          {
+                              CHECK_EQ(len, std::format("label {}", ival).size());
+                              CHECK_EQ(label, std::format("label {}", ival));
+                          }
+                          CHECK_EQ(odd.has_value(), ival % 2 != 0);
+                      });
+    }
+
+    SUBCASE("parallel aggregation and constants")
+    {
+        dfe::register_scalar(con, "square", [](double x) { return x * x; });
+
+        dfe::for_each(con.Query("select sum(square(rval)), square(3), count(*) from t"),
+                      [&](double sum, double constant, int64_t count)
+                      {
+                          double expected{0};
+                          for (int64_t i{0}; i < NUM_ROWS; ++i)
+                              expected += (i * 0.5) * (i * 0.5);
+                          CHECK_EQ(sum, doctest::Approx(expected));
+                          CHECK_EQ(constant, 9);
+                          CHECK_EQ(count, NUM_ROWS);
+                      });
+    }
+
+    SUBCASE("errors")
+    {
+        dfe::register_scalar(con, "fails",
+                             [](int64_t ival) -> int64_t
+                             {
+                                 if (ival == 5000)
+                                     throw std::runtime_error{"bad value"};
+                                 return ival;
+                             });
+        auto result{con.Query("select fails(ival) from t")};
+        CHECK(result->HasError());
+
+        // Argument types are checked when binding the query.
+        result = con.Query("select fails('abc')");
+        CHECK(result->HasError());
+    }
+}
+
+namespace {
+
+struct Vwap
+{
+    double notional{0};
+    int64_t volume{0};
+};
+
+// A state that is not trivially destructible.
+struct Labels
+{
+    std::vector<std::string> labels;
+};
+
+} // namespace
+
+TEST_CASE("Test aggregate functions")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    constexpr int64_t NUM_ROWS{200'000};
+    constexpr int64_t NUM_KEYS{50};
+
+    auto res{con.Query(std::format("CREATE TABLE trades AS "
+                                   "SELECT 'SYM' || (i % {1}) AS symbol, 100 + (i % 13) * 0.5 "
+                                   "AS price, CASE WHEN i % 101 = 0 THEN NULL ELSE i % 7 + 1 "
+                                   "END AS qty FROM range({0}) t(i)",
+                                   NUM_ROWS, NUM_KEYS))};
+    REQUIRE_FALSE(res->HasError());
+
+    dfe::register_aggregate<Vwap>(
+        con, "vwap",
+        [](Vwap& state, double price, int64_t qty)
+        {
+            state.notional += price * qty;
+            state.volume += qty;
+        },
+        [](Vwap& lhs, const Vwap& rhs)
+        {
+            lhs.notional += rhs.notional;
+            lhs.volume += rhs.volume;
+        },
+        [](const Vwap& state) -> std::optional<double>
+        {
+            if (state.volume == 0)
+                return std::nullopt;
+            return state.notional / state.volume;
+        });
+
+    SUBCASE("grouped")
+    {
+        std::unordered_map<std::string, double> expected;
+        dfe::for_each(con.Query("select symbol, sum(price * qty) / sum(qty) from trades "
+                                "group by symbol"),
+                      [&](std::string symbol, double vwap) { expected[symbol] = vwap; });
+
+        std::size_t numGroups{0};
+        dfe::for_each(con.Query("select symbol, vwap(price, qty) from trades group by symbol"),
+                      [&](std::string symbol, double vwap)
+                      {
+                          CHECK_EQ(vwap, doctest::Approx(expected.at(symbol)));
+                          ++numGroups;
+                      });
+        CHECK_EQ(numGroups, NUM_KEYS);
+    }
+
+    SUBCASE("ungrouped and empty")
+    {
+        dfe::for_each(con.Query("select vwap(price, qty), sum(price * qty) / sum(qty) "
+                                "from trades"),
+                      [](double vwap, double expected)
+                      { CHECK_EQ(vwap, doctest::Approx(expected)); });
+
+        dfe::for_each(con.Query("select vwap(price, qty) from trades where false"),
+                      [](std::optional<double> vwap) { CHECK_FALSE(vwap); });
+    }
+
+    SUBCASE("states with resources")
+    {
+        dfe::register_aggregate<Labels>(
+            con, "label_count",
+            [](Labels& state, const std::string& symbol, std::optional<int64_t> qty)
+            {
+                if (qty && *qty == 7)
+                    state.labels.push_back(symbol);
+            },
+            [](Labels& lhs, const Labels& rhs)
+            { lhs.labels.insert(lhs.labels.end(), rhs.labels.begin(), rhs.labels.end()); },
+            [](const Labels& state) { return static_cast<int64_t>(state.labels.size()); });
+
+        dfe::for_each(con.Query("select label_count(symbol, qty), "
+                                "count(*) filter (where qty = 7) from trades"),
+                      [](int64_t count, int64_t expected) { CHECK_EQ(count, expected); });
+    }
+
+    SUBCASE("state alignment")
+    {
+        // DuckDB aligns states to 8 bytes, more aligned states are rejected at compile time.
+        struct alignas(16) Aligned16
+        {
+            double value{0};
+        };
+
+        CHECK(dfe::details::is_aggregate_state_v<Vwap>);
+        CHECK(dfe::details::is_aggregate_state_v<int64_t>);
+        CHECK_FALSE(dfe::details::is_aggregate_state_v<Aligned16>);
+        CHECK_FALSE(dfe::details::is_aggregate_state_v<__int128>);
+    }
+
+    SUBCASE("functions are released with the database")
+    {
+        auto counter{std::make_shared<int64_t>(0)};
+        auto registerCount = [&](ddb::Connection& other)
+        {
+            dfe::register_aggregate<int64_t>(
+                other, "count_calls", [counter](int64_t& state, int64_t) { ++state; },
+                [](int64_t& lhs, int64_t rhs) { lhs += rhs; },
+                [](int64_t state) { return state; });
+        };
+
+        {
+            ddb::DuckDB other{nullptr};
+            ddb::Connection otherCon{other};
+            registerCount(otherCon);
+            CHECK_EQ(counter.use_count(), 2);
+        }
+
+        // Registering on a new database releases the functions of the closed one.
+        ddb::DuckDB other{nullptr};
+        ddb::Connection otherCon{other};
+        registerCount(otherCon);
+        CHECK_EQ(counter.use_count(), 2);
+
+        dfe::for_each(otherCon.Query("select count_calls(i) from range(1000) t(i)"),
+                      [](int64_t count) { CHECK_EQ(count, 1000); });
+    }
+}
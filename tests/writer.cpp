@@ -0,0 +1,165 @@
+// Copyright (C) 2024 Vince Vasta
+// SPDX-License-Identifier: Apache-2.0
+#include "doctest.h"
+
+#include "duckforeach.hpp"
+
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace ddb = duckdb;
+namespace dfe = duckforeach;
+
+namespace {
+
+std::string write(std::unique_ptr<ddb::QueryResult> result, const dfe::WriteOptions& options = {})
+{
+    std::ostringstream os;
+    dfe::write_csv(std::move(result), os, options);
+    return os.str();
+}
+
+} // namespace
+
+TEST_CASE("Test text writer")
+{
+    ddb::DuckDB db;
+    ddb::Connection con{db};
+
+    auto res{con.Query("CREATE TABLE t ("
+                       "  ival INTEGER, "
+                       "  rval DOUBLE, "
+                       "  sval VARCHAR, "
+                       "  bval BOOLEAN, "
+                       "  dtval DATE, "
+                       "  tsval TIMESTAMP)")};
+    REQUIRE_FALSE(res->HasError());
+
+    res = con.Query("INSERT INTO t VALUES "
+                    "(1, 0.5, 'plain', true, '2024-06-01', '2024-06-01 11:30:00'), "
+                    "(-2, 1e20, 'a,b \"c\"', false, '1999-12-31', '2024-06-01 11:30:00.25'), "
+                    "(null, null, null, null, null, null), "
+                    "(3, -1.25, 'tab\tline\nend\\', true, '0100-01-02', "
+                    " '1969-12-31 23:59:59.000001'), "
+                    "(4, 2, '', false, 'infinity', 'infinity')");
+    REQUIRE_FALSE(res->HasError());
+
+    const std::string query{"select * from t order by rowid"};
+
+    SUBCASE("csv")
+    {
+        CHECK_EQ(write(con.Query(query)),
+                 "ival,rval,sval,bval,dtval,tsval\n"
+                 "1,0.5,plain,true,2024-06-01,2024-06-01 11:30:00\n"
+                 "-2,1e+20,\"a,b \"\"c\"\"\",false,1999-12-31,2024-06-01 11:30:00.25\n"
+                 ",,,,,\n"
+                 "3,-1.25,\"tab\tline\nend\\\",true,0100-01-02,1969-12-31 23:59:59.000001\n"
+                 "4,2,\"\",false,infinity,infinity\n");
+
+        CHECK_EQ(write(con.Query(query), {.header = false, .null_value = "NULL"}),
+                 "1,0.5,plain,true,2024-06-01,2024-06-01 11:30:00\n"
+                 "-2,1e+20,\"a,b \"\"c\"\"\",false,1999-12-31,2024-06-01 11:30:00.25\n"
+                 "NULL,NULL,NULL,NULL,NULL,NULL\n"
+                 "3,-1.25,\"tab\tline\nend\\\",true,0100-01-02,1969-12-31 23:59:59.000001\n"
+                 "4,2,,false,infinity,infinity\n");
+    }
+
+    SUBCASE("tsv")
+    {
+        CHECK_EQ(write(con.Query(query), {.format = dfe::TextFormat::tsv, .null_value = "\\N"}),
+                 "ival\trval\tsval\tbval\tdtval\ttsval\n"
+                 "1\t0.5\tplain\ttrue\t2024-06-01\t2024-06-01 11:30:00\n"
+                 "-2\t1e+20\ta,b \"c\"\tfalse\t1999-12-31\t2024-06-01 11:30:00.25\n"
+                 "\\N\t\\N\t\\N\t\\N\t\\N\t\\N\n"
+                 "3\t-1.25\ttab\\tline\\nend\\\\\ttrue\t0100-01-02\t1969-12-31 23:59:59.000001\n"
+                 "4\t2\t\tfalse\tinfinity\tinfinity\n");
+    }
+
+    SUBCASE("json lines")
+    {
+        CHECK_EQ(
+            write(con.Query(query), {.format = dfe::TextFormat::jsonl}),
+            "{\"ival\":1,\"rval\":0.5,\"sval\":\"plain\",\"bval\":true,"
+            "\"dtval\":\"2024-06-01\",\"tsval\":\"2024-06-01 11:30:00\"}\n"
+            "{\"ival\":-2,\"rval\":1e+20,\"sval\":\"a,b \\\"c\\\"\",\"bval\":false,"
+            "\"dtval\":\"1999-12-31\",\"tsval\":\"2024-06-01 11:30:00.25\"}\n"
+            "{\"ival\":null,\"rval\":null,\"sval\":null,\"bval\":null,"
+            "\"dtval\":null,\"tsval\":null}\n"
+            "{\"ival\":3,\"rval\":-1.25,\"sval\":\"tab\\tline\\nend\\\\\",\"bval\":true,"
+            "\"dtval\":\"0100-01-02\",\"tsval\":\"1969-12-31 23:59:59.000001\"}\n"
+            "{\"ival\":4,\"rval\":2,\"sval\":\"\",\"bval\":false,"
+            "\"dtval\":\"infinity\",\"tsval\":\"infinity\"}\n");
+
+        CHECK_EQ(write(con.Query("select 'nan'::double as \"a\"\"b\", 'x\x01' as c"),
+                       {.format = dfe::TextFormat::jsonl}),
+                 "{\"a\\\"b\":null,\"c\":\"x\\u0001\"}\n");
+    }
+
+    SUBCASE("other types")
+    {
+        CHECK_EQ(write(con.Query("select 12::TINYINT, 170141183460469231731687303715884105727, "
+                                 "'10:11:12'::TIME, 1.50::DECIMAL(4, 2), "
+                                 "'2024-06-01 11:30:00.123456'::TIMESTAMP_NS, "
+                                 "'2024-06-01 11:30:01.5'::TIMESTAMP_MS, "
+                                 "'2024-06-01 11:30:01'::TIMESTAMP_S, '\\xAA'::BLOB, "
+                                 "'101'::BIT, [1, 2]"),
+                       {.header = false}),
+                 "12,170141183460469231731687303715884105727,10:11:12,1.50,"
+                 "2024-06-01 11:30:00.123456,2024-06-01 11:30:01.5,2024-06-01 11:30:01,"
+                 "\\xAA,101,\"[1, 2]\"\n");
+    }
+
+    SUBCASE("multiple chunks and flushes")
+    {
+        constexpr int64_t NUM_ROWS{10'000};
+
+        std::string expected{"i,label,ts\n"};
+        for (int64_t i{0}; i < NUM_ROWS; ++i)
+            expected += std::format("{},label {},2024-06-{:02} {:02}:{:02}:00\n", i, i,
+                                    1 + i / 1440, i / 60 % 24, i % 60);
+
+        const std::string query{"select i, 'label ' || i as label, "
+                                "TIMESTAMP '2024-06-01' + INTERVAL (i) MINUTE as ts "
+                                "from range({}) t(i) order by i"};
+
+        std::ostringstream os;
+        CHECK_EQ(dfe::write_csv(con.Query(std::format(query, NUM_ROWS)), os,
+                                {.buffer_size = 1024}),
+                 NUM_ROWS);
+        CHECK_EQ(os.str(), expected);
+
+        CHECK_EQ(write(con.SendQuery(std::format(query, NUM_ROWS))), expected);
+    }
+
+    SUBCASE("file descriptor")
+    {
+        auto file{std::tmpfile()};
+        REQUIRE(file);
+
+        CHECK_EQ(dfe::write_csv(con.Query(query), fileno(file), {.header = false}), 5);
+
+        std::rewind(file);
+        std::string content(1024, '\0');
+        content.resize(std::fread(content.data(), 1, content.size(), file));
+        std::fclose(file);
+
+        CHECK_EQ(content, write(con.Query(query), {.header = false}));
+    }
+
+    SUBCASE("errors")
+    {
+        std::ostringstream os;
+        CHECK_THROWS_AS(dfe::write_csv(nullptr, os), std::invalid_argument);
+        CHECK_THROWS_AS(dfe::write_csv(con.Query("select * from notable"), os),
+                        std::runtime_error);
+        CHECK_THROWS_AS(dfe::write_csv(con.Query(query), os, {.buffer_size = 10}),
+                        std::invalid_argument);
+
+        os.setstate(std::ios::badbit);
+        CHECK_THROWS_AS(dfe::write_csv(con.Query(query), os), std::runtime_error);
+
+        CHECK_THROWS_AS(dfe::write_csv(con.Query(query), -1), std::system_error);
+    }
+}